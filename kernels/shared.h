@@ -94,6 +94,52 @@ struct Camera
 	float  m_fov;
 };
 
+// Sample budget of the AO integrators, spp primary samples per pixel with aoSamples AO rays each. errorThreshold above 0
+// turns on adaptive sampling: pixels are sampled in rounds of minSpp and a pixel stops once the standard error of its
+// mean AO is below errorThreshold. The pixels of a tile share spp samples per pixel, so the noisy ones go on with what
+// the converged ones leave, up to maxSpp each. With errorThreshold 0 every pixel gets exactly spp samples.
+struct AoSampling
+{
+	uint32_t spp			= 512;
+	uint32_t aoSamples		= 32;
+	uint32_t minSpp			= 32;
+	uint32_t maxSpp			= 2048;
+	float	 errorThreshold = 0.0f;
+};
+
+// Running mean and variance of the samples of one pixel, Welford's update with the mean kept as a sum so that a fixed
+// sample count gives the same sum as a plain accumulation
+struct SampleEstimate
+{
+	float	 sum   = 0.0f;
+	float	 m2	   = 0.0f;
+	uint32_t count = 0;
+};
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void addSample( SampleEstimate& estimate, float value )
+{
+	const float oldMean = estimate.count > 0 ? estimate.sum / estimate.count : 0.0f;
+	estimate.count++;
+	estimate.sum += value;
+	estimate.m2 += ( value - oldMean ) * ( value - estimate.sum / estimate.count );
+}
+
+// mean of samples that are sums of scale values each (unoccluded AO rays of a primary sample), divided the same way as
+// the plain sum over count * scale
+HIPRT_HOST_DEVICE HIPRT_INLINE float sampleMean( const SampleEstimate& estimate, uint32_t scale )
+{
+	return estimate.count > 0 ? estimate.sum / ( estimate.count * scale ) : 0.0f;
+}
+
+// variance of the mean is m2 / (n - 1) / n, compared squared. The threshold is in units of the mean of sampleMean.
+HIPRT_HOST_DEVICE HIPRT_INLINE bool isConverged( const SampleEstimate& estimate, float errorThreshold, uint32_t scale )
+{
+	if ( estimate.count < 2 ) return false;
+	const float n		  = static_cast<float>( estimate.count );
+	const float threshold = errorThreshold * scale;
+	return estimate.m2 <= threshold * threshold * n * ( n - 1.0f );
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE float3 gammaCorrect( float3 a )
 {
 	float g = 1.0f / 2.2f;
@@ -169,3 +215,40 @@ generateRay( float x, float y, int2 res, const Camera& camera, uint32_t& seed, b
     ray.direction = hiprt::normalize(dir.x * holDir + dir.y * upDir + dir.z * viewDir);
     return ray;
 }
+
+// Analytic sphere of a sphere list, center in xyz and radius in w. Nearest root in [ray.minT, maxT], the direction need
+// not be normalized (object space rays of scaled instances). The quadratic is solved for the point closest to the center
+// first, which keeps small spheres far from the origin free of cancellation. The normal is the object space vector from
+// the center to the hit point and uv are its longitude and latitude in [0, 1].
+HIPRT_HOST_DEVICE HIPRT_INLINE bool intersectSphere( const hiprtRay& ray, const float4& sphere, float maxT, hiprtHit& hit )
+{
+	const float3 center = make_float3( sphere.x, sphere.y, sphere.z );
+	const float	 radius = sphere.w;
+	const float3 oc		= ray.origin - center;
+	const float	 a		= hiprt::dot( ray.direction, ray.direction );
+	const float	 b		= hiprt::dot( oc, ray.direction );
+	const float3 l		= oc - ( b / a ) * ray.direction;
+	const float	 disc	= radius * radius - hiprt::dot( l, l );
+	if ( disc < 0.0f ) return false;
+
+	const float q  = -b - copysignf( sqrtf( a * disc ), b );
+	const float c  = hiprt::dot( oc, oc ) - radius * radius;
+	float		t0 = q != 0.0f ? c / q : 0.0f;
+	float		t1 = q / a;
+	if ( t0 > t1 )
+	{
+		const float t = t0;
+		t0			  = t1;
+		t1			  = t;
+	}
+
+	const float t = t0 >= ray.minT ? t0 : t1;
+	if ( t < ray.minT || t > maxT ) return false;
+
+	const float3 n = oc + t * ray.direction;
+	hit.t		   = t;
+	hit.normal	   = n;
+	hit.uv.x	   = 0.5f + atan2f( n.z, n.x ) * ( 0.5f / hiprt::Pi );
+	hit.uv.y	   = acosf( fminf( fmaxf( n.y / radius, -1.0f ), 1.0f ) ) / hiprt::Pi;
+	return true;
+}
@@ -20,6 +20,7 @@ enum class GEOMETRY_TYPE : uint32_t
 {
     TRIANGLE_MESH = 0,
     TRIANGLE_MESH_DEFORMED,
+    SPHERE_LIST,
 
     GEOMETRY_TYPE_COUNT
 };
@@ -38,6 +39,8 @@ struct GeometryData
     uint32_t nDeformations{0};
     uint32_t geometryID{0};
     uint32_t instanceID{0};
+    // center and radius of each primitive of a SPHERE_LIST geometry
+    float4* spheres{nullptr};
 };
 
 struct Payload
@@ -164,9 +167,12 @@ HIPRT_DEVICE bool IntersectDeformation(const hiprtRay& ray, const void* data, vo
         float timeFrac = timeScaled - floorf(timeScaled);
         uint f0 = timeScaled;
         uint f1 = min(f0 + 1, numDeformationSteps - 1);
-        p0 = Lerp(meshData.vertices[v_idx.x * numDeformationSteps + f0], meshData.vertices[v_idx.x * numDeformationSteps + f1], timeFrac);
-        p1 = Lerp(meshData.vertices[v_idx.y * numDeformationSteps + f0], meshData.vertices[v_idx.y * numDeformationSteps + f1], timeFrac);
-        p2 = Lerp(meshData.vertices[v_idx.z * numDeformationSteps + f0], meshData.vertices[v_idx.z * numDeformationSteps + f1], timeFrac);
+        // key frames are stored one after another (ApplyDeformation)
+        const float3* frame0 = meshData.vertices + f0 * meshData.nUniqueVertices;
+        const float3* frame1 = meshData.vertices + f1 * meshData.nUniqueVertices;
+        p0 = Lerp(frame0[v_idx.x], frame1[v_idx.x], timeFrac);
+        p1 = Lerp(frame0[v_idx.y], frame1[v_idx.y], timeFrac);
+        p2 = Lerp(frame0[v_idx.z], frame1[v_idx.z], timeFrac);
     }
     else
     {
@@ -189,6 +195,17 @@ HIPRT_DEVICE bool IntersectDeformation(const hiprtRay& ray, const void* data, vo
 
 
 
+HIPRT_DEVICE bool IntersectSphereList(const hiprtRay& ray, const void* data, void* payload, hiprtHit& hit)
+{
+    const GeometryData* const sceneData = reinterpret_cast<const GeometryData* const>(data);
+    const GeometryData& sphereData = sceneData[hit.instanceID];
+
+    if (intersectSphere(ray, sphereData.spheres[hit.primID], ray.maxT, hit))
+        return HIPRT_INTERSECTION_HIT;
+
+    return HIPRT_INTERSECTION_MISS;
+}
+
 HIPRT_DEVICE bool AnyhitDeformation(const hiprtRay& ray, const void* data, void* payload, const hiprtHit& hit)
 {
     const GeometryData* const sceneData = reinterpret_cast<const GeometryData* const>(data);
@@ -231,6 +248,8 @@ HIPRT_DEVICE bool intersectFunc( uint geomType, uint rayType, const hiprtFuncTab
 	 {
      case static_cast<uint>(GEOMETRY_TYPE::TRIANGLE_MESH_DEFORMED):
          return IntersectDeformation(ray, data, payload, hit);
+     case static_cast<uint>(GEOMETRY_TYPE::SPHERE_LIST):
+         return IntersectSphereList(ray, data, payload, hit);
 	 default:
 	 	return HIPRT_INTERSECTION_MISS;
 	 }
@@ -428,6 +447,9 @@ extern "C" __global__ void SimpleMeshIntersectionKernelCamera(hiprtGeometry geom
     image[index * 4 + 3] = 255;
 }
 
+// AO of a scene with the sample budget of sampling. The pixels of a block are sampled in rounds of minSpp samples, a
+// pixel whose error is below errorThreshold after a round stops and the others go on while the block has not used spp
+// samples per pixel, up to maxSpp each. errorThreshold 0 samples every pixel spp times.
 extern "C" __global__ void __launch_bounds__( 64 ) AoRayKernel(
 	hiprtScene			   scene,
 	uint8_t*			   image,
@@ -435,18 +457,16 @@ extern "C" __global__ void __launch_bounds__( 64 ) AoRayKernel(
 	hiprtGlobalStackBuffer globalStackBuffer,
 	Camera				   camera,
 	float				   aoRadius,
-	hiprtFuncTable		   table )
+	hiprtFuncTable		   table,
+	AoSampling			   sampling )
 {
 	const uint32_t x	 = blockIdx.x * blockDim.x + threadIdx.x;
 	const uint32_t y	 = blockIdx.y * blockDim.y + threadIdx.y;
 	const uint32_t index = x + y * resolution.x;
 
-	constexpr uint32_t Spp		 = 512;
-	constexpr uint32_t AoSamples = 32;
-
-	int3   color{};
-	float3 diffuseColor = make_float3( 1.0f );
-	float  ao			= 0.0f;
+	int3		   color{};
+	float3		   diffuseColor = make_float3( 1.0f );
+	SampleEstimate estimate;
 
 	__shared__ uint32_t	   sharedStackCache[SHARED_STACK_SIZE * BLOCK_SIZE];
 	hiprtSharedStackBuffer sharedStackBuffer{ SHARED_STACK_SIZE, sharedStackCache };
@@ -454,20 +474,35 @@ extern "C" __global__ void __launch_bounds__( 64 ) AoRayKernel(
 	Stack		  stack( globalStackBuffer, sharedStackBuffer );
 	InstanceStack instanceStack;
 
-	
-
-	for ( uint32_t p = 0; p < Spp; p++ )
+	// the grid is rounded up to whole blocks, the threads past the image only take part in the barriers of the rounds
+	const bool	   adaptive = sampling.errorThreshold > 0.0f;
+	const uint32_t batch	= adaptive ? max( sampling.minSpp, 1u ) : sampling.spp;
+	const uint32_t maxSpp	= adaptive ? max( sampling.maxSpp, batch ) : sampling.spp;
+	bool		   active	= x < resolution.x && y < resolution.y;
+
+	// every thread of the block sees the same counts, so all of them leave the loop in the same round
+	uint32_t	   activeCount = __syncthreads_count( active );
+	const uint64_t budget	   = static_cast<uint64_t>( sampling.spp ) * activeCount;
+	uint64_t	   spent	   = 0;
+	uint32_t	   sampleCount = 0;
+	while ( activeCount > 0 && sampleCount < maxSpp && spent < budget )
 	{
-		uint32_t seed = tea<16>( x + y * resolution.x, p ).x;
-		
-		hiprtRay													ray = generateRay( x, y, resolution, camera, seed, true );
-		hiprtSceneTraversalClosestCustomStack<Stack, InstanceStack> tr( scene, ray, stack, instanceStack );
+		// a round never runs past the budget, spp below minSpp samples every pixel spp times
+		const uint64_t left = ( budget - spent ) / activeCount;
+		if ( left == 0 ) break;
+		const uint32_t next = min( sampleCount + static_cast<uint32_t>( min( static_cast<uint64_t>( batch ), left ) ), maxSpp );
+		for ( uint32_t p = sampleCount; active && p < next; p++ )
 		{
-			hiprtHit hit = tr.getNextHit();
+			uint32_t seed = tea<16>( index, p ).x;
+			float	 ao	  = 0.0f;
 
+			hiprtRay ray = generateRay( x, y, resolution, camera, seed, true );
+			// the table intersects custom geometry (sphere lists) for the primary rays as well
+			hiprtSceneTraversalClosestCustomStack<Stack, InstanceStack> tr(
+				scene, ray, stack, instanceStack, hiprtFullRayMask, hiprtTraversalHintDefault, nullptr, table );
+			hiprtHit hit = tr.getNextHit();
 			if ( hit.hasHit() )
 			{
-				
 				const float3 surfacePt = ray.origin + hit.t * ( 1.0f - 1.0e-2f ) * ray.direction;
 
 				float3 Ng = hiprtVectorObjectToWorld( hit.normal, scene, hit.instanceID );
@@ -477,22 +512,27 @@ extern "C" __global__ void __launch_bounds__( 64 ) AoRayKernel(
 				hiprtRay aoRay;
 				aoRay.origin = surfacePt;
 				aoRay.maxT	 = aoRadius;
-				hiprtHit aoHit;
 
-				for ( uint32_t i = 0; i < AoSamples; i++ )
+				for ( uint32_t i = 0; i < sampling.aoSamples; i++ )
 				{
 					aoRay.direction = sampleHemisphereCosine( Ng, seed );
-					hiprtSceneTraversalAnyHitCustomStack<Stack, InstanceStack> tr(
+					hiprtSceneTraversalAnyHitCustomStack<Stack, InstanceStack> aoTr(
 						scene, aoRay, stack, instanceStack, hiprtFullRayMask, hiprtTraversalHintDefault, nullptr, table );
-					aoHit = tr.getNextHit();
-					ao += !aoHit.hasHit() ? 1.0f : 0.0f;
+					ao += !aoTr.getNextHit().hasHit() ? 1.0f : 0.0f;
 				}
-				
 			}
+			addSample( estimate, ao );
 		}
+		spent += static_cast<uint64_t>( next - sampleCount ) * activeCount;
+		sampleCount = next;
+
+		if ( active && isConverged( estimate, sampling.errorThreshold, sampling.aoSamples ) ) active = false;
+		activeCount = __syncthreads_count( active );
 	}
 
-	ao = ao / ( Spp * AoSamples );
+	if ( x >= resolution.x || y >= resolution.y ) return;
+
+	const float ao = sampleMean( estimate, sampling.aoSamples );
 
 	color.x = ( ao * diffuseColor.x ) * 255;
 	color.y = ( ao * diffuseColor.y ) * 255;
@@ -504,6 +544,69 @@ extern "C" __global__ void __launch_bounds__( 64 ) AoRayKernel(
 	image[index * 4 + 3] = 255;
 }
 
+// One jittered primary sample of the AO of a geometry per launch. The AO of the sample is added to accumulation and the
+// image shows the mean over sampleIndex + 1 samples, sampleIndex 0 starts a new accumulation. The seeds follow
+// sampleIndex, so every frame adds new samples instead of repeating the last ones.
+extern "C" __global__ void __launch_bounds__( 64 ) AoRayKernelProgressive(
+	hiprtGeometry		   geometry,
+	float*				   accumulation,
+	uint8_t*			   image,
+	int2				   resolution,
+	hiprtGlobalStackBuffer globalStackBuffer,
+	Camera				   camera,
+	float				   aoRadius,
+	uint32_t			   sampleIndex )
+{
+	const uint32_t x	 = blockIdx.x * blockDim.x + threadIdx.x;
+	const uint32_t y	 = blockIdx.y * blockDim.y + threadIdx.y;
+	const uint32_t index = x + y * resolution.x;
+
+	constexpr uint32_t AoSamples = 32;
+
+	__shared__ uint32_t	   sharedStackCache[SHARED_STACK_SIZE * BLOCK_SIZE];
+	hiprtSharedStackBuffer sharedStackBuffer{ SHARED_STACK_SIZE, sharedStackCache };
+
+	Stack stack( globalStackBuffer, sharedStackBuffer );
+
+	// the grid is rounded up to whole blocks, the threads past the image still took part in the shared stack setup
+	if ( x >= resolution.x || y >= resolution.y ) return;
+
+	uint32_t seed = tea<16>( index, sampleIndex ).x;
+	float	 ao	  = 0.0f;
+
+	hiprtRay									ray = generateRay( x, y, resolution, camera, seed, true );
+	hiprtGeomTraversalClosestCustomStack<Stack> tr( geometry, ray, stack );
+	hiprtHit									hit = tr.getNextHit();
+	if ( hit.hasHit() )
+	{
+		const float3 surfacePt = ray.origin + hit.t * ( 1.0f - 1.0e-2f ) * ray.direction;
+
+		float3 Ng = hit.normal;
+		if ( hiprt::dot( ray.direction, Ng ) > 0.0f ) Ng = -Ng;
+		Ng = hiprt::normalize( Ng );
+
+		hiprtRay aoRay;
+		aoRay.origin = surfacePt;
+		aoRay.maxT	 = aoRadius;
+
+		for ( uint32_t i = 0; i < AoSamples; i++ )
+		{
+			aoRay.direction = sampleHemisphereCosine( Ng, seed );
+			hiprtGeomTraversalAnyHitCustomStack<Stack> aoTr( geometry, aoRay, stack );
+			ao += !aoTr.getNextHit().hasHit() ? 1.0f : 0.0f;
+		}
+		ao /= AoSamples;
+	}
+
+	const float sum		= ( sampleIndex == 0 ? 0.0f : accumulation[index] ) + ao;
+	accumulation[index] = sum;
+	const uint8_t value = static_cast<uint8_t>( hiprt::clamp( sum / ( sampleIndex + 1 ), 0.0f, 1.0f ) * 255 );
+	image[index * 4 + 0] = value;
+	image[index * 4 + 1] = value;
+	image[index * 4 + 2] = value;
+	image[index * 4 + 3] = 255;
+}
+
 extern "C" __global__ void __launch_bounds__(64)
     AoRayKernelMotionBlurSlerp(hiprtScene scene, uint8_t* image, int2 resolution, hiprtGlobalStackBuffer globalStackBuffer, Camera camera, float aoRadius, hiprtFuncTable table)
 {
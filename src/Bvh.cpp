@@ -0,0 +1,467 @@
+#include "Bvh.h"
+#include "Parallel.h"
+#include "TrianglePairs.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+constexpr uint32_t ChunkSize = 4096;
+// right children with at least this many primitives are built by a task of their own
+constexpr uint32_t SubtreeTaskSize = 4096;
+
+struct Bin
+{
+    hiprt::Aabb box;
+    uint32_t count{0};
+};
+
+struct RangeBounds
+{
+    hiprt::Aabb box;
+    hiprt::Aabb centroidBox;
+};
+
+struct BuildTask
+{
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t depth;
+};
+
+uint32_t Log2Ceil(uint32_t value)
+{
+    uint32_t log = 0;
+    while ((1u << log) < value && log < 31) log++;
+    return log;
+}
+
+uint32_t ChunkCount(uint32_t count)
+{
+    return (count + ChunkSize - 1) / ChunkSize;
+}
+
+RangeBounds ComputeRangeBounds(const std::vector<hiprt::Aabb>& boxes, const std::vector<float3>& centroids, const uint32_t* refs, uint32_t count, const BvhBuildOptions& options)
+{
+    auto computeChunk = [&](uint32_t begin, uint32_t end) {
+        RangeBounds bounds;
+        for (uint32_t i = begin; i < end; i++)
+        {
+            bounds.box.grow(boxes[refs[i]]);
+            bounds.centroidBox.grow(centroids[refs[i]]);
+        }
+        return bounds;
+    };
+
+    if (count <= options.parallelThreshold)
+        return computeChunk(0, count);
+
+    std::vector<RangeBounds> partial(ChunkCount(count));
+    ParallelFor(static_cast<uint32_t>(partial.size()), [&](uint32_t chunk, uint32_t) {
+        partial[chunk] = computeChunk(chunk * ChunkSize, std::min(count, (chunk + 1) * ChunkSize));
+    });
+
+    RangeBounds bounds;
+    for (const auto& p : partial)
+    {
+        bounds.box.grow(p.box);
+        bounds.centroidBox.grow(p.centroidBox);
+    }
+    return bounds;
+}
+
+// bins[axis * binCount + bin]
+void BinRange(const std::vector<hiprt::Aabb>& boxes,
+              const std::vector<float3>& centroids,
+              const uint32_t* refs,
+              uint32_t count,
+              const hiprt::Aabb& centroidBox,
+              const BvhBuildOptions& options,
+              std::vector<Bin>& bins)
+{
+    const uint32_t binCount = options.binCount;
+    const float3 extent = centroidBox.extent();
+    float scale[3];
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        float e = hiprt::ptr(extent)[axis];
+        scale[axis] = e > 0.0f ? binCount / e : 0.0f;
+    }
+
+    auto binChunk = [&](uint32_t begin, uint32_t end, std::vector<Bin>& out) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const uint32_t ref = refs[i];
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                float offset = hiprt::ptr(centroids[ref])[axis] - hiprt::ptr(centroidBox.m_min)[axis];
+                uint32_t b = std::min(binCount - 1, static_cast<uint32_t>(offset * scale[axis]));
+                Bin& bin = out[axis * binCount + b];
+                bin.box.grow(boxes[ref]);
+                bin.count++;
+            }
+        }
+    };
+
+    bins.assign(3 * binCount, Bin{});
+    if (count <= options.parallelThreshold)
+    {
+        binChunk(0, count, bins);
+        return;
+    }
+
+    std::vector<std::vector<Bin>> partial(ChunkCount(count), std::vector<Bin>(3 * binCount));
+    ParallelFor(static_cast<uint32_t>(partial.size()), [&](uint32_t chunk, uint32_t) {
+        binChunk(chunk * ChunkSize, std::min(count, (chunk + 1) * ChunkSize), partial[chunk]);
+    });
+
+    for (const auto& p : partial)
+    {
+        for (uint32_t i = 0; i < bins.size(); i++)
+        {
+            bins[i].box.grow(p[i].box);
+            bins[i].count += p[i].count;
+        }
+    }
+}
+
+uint32_t MedianSplit(const std::vector<float3>& centroids, uint32_t* refs, uint32_t count, const hiprt::Aabb& centroidBox)
+{
+    const float3 extent = centroidBox.extent();
+    uint32_t axis = 0;
+    if (extent.y > extent.x)
+        axis = 1;
+    if (extent.z > hiprt::ptr(extent)[axis])
+        axis = 2;
+
+    const uint32_t mid = count / 2;
+    std::nth_element(refs, refs + mid, refs + count, [&](uint32_t a, uint32_t b) { return hiprt::ptr(centroids[a])[axis] < hiprt::ptr(centroids[b])[axis]; });
+    return mid;
+}
+
+// Returns the size of the left partition, 0 when the range should become a leaf
+uint32_t SplitRange(const std::vector<hiprt::Aabb>& boxes,
+                    const std::vector<float3>& centroids,
+                    uint32_t* refs,
+                    uint32_t count,
+                    uint32_t depth,
+                    const RangeBounds& bounds,
+                    const BvhBuildOptions& options,
+                    std::vector<Bin>& bins)
+{
+    if (count <= 1)
+        return 0;
+
+    // keep the tree shallow enough for the fixed traversal stack
+    if (depth + Log2Ceil(count) + 1 >= MaxBvhDepth)
+        return MedianSplit(centroids, refs, count, bounds.centroidBox);
+
+    const float3 extent = bounds.centroidBox.extent();
+    if (extent.x <= 0.0f && extent.y <= 0.0f && extent.z <= 0.0f)
+        return count <= options.maxLeafSize ? 0 : count / 2;
+
+    BinRange(boxes, centroids, refs, count, bounds.centroidBox, options, bins);
+
+    const uint32_t binCount = options.binCount;
+    const float parentArea = bounds.box.area();
+    float bestCost = std::numeric_limits<float>::max();
+    uint32_t bestAxis = 0;
+    uint32_t bestBin = 0;
+
+    std::vector<float> rightArea(binCount);
+    std::vector<uint32_t> rightCount(binCount);
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        if (hiprt::ptr(extent)[axis] <= 0.0f)
+            continue;
+
+        const Bin* axisBins = &bins[axis * binCount];
+        hiprt::Aabb box;
+        uint32_t sum = 0;
+        for (uint32_t b = binCount - 1; b > 0; b--)
+        {
+            box.grow(axisBins[b].box);
+            sum += axisBins[b].count;
+            rightArea[b] = box.area();
+            rightCount[b] = sum;
+        }
+
+        box.reset();
+        sum = 0;
+        for (uint32_t b = 1; b < binCount; b++)
+        {
+            box.grow(axisBins[b - 1].box);
+            sum += axisBins[b - 1].count;
+            if (sum == 0 || rightCount[b] == 0)
+                continue;
+
+            float cost = options.traversalCost + options.intersectionCost * (box.area() * sum + rightArea[b] * rightCount[b]) / parentArea;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    const float leafCost = options.intersectionCost * count;
+    if (count <= options.maxLeafSize && leafCost <= bestCost)
+        return 0;
+
+    if (bestCost == std::numeric_limits<float>::max())
+        return MedianSplit(centroids, refs, count, bounds.centroidBox);
+
+    const float axisMin = hiprt::ptr(bounds.centroidBox.m_min)[bestAxis];
+    const float scale = binCount / hiprt::ptr(extent)[bestAxis];
+    uint32_t* mid = std::partition(refs, refs + count, [&](uint32_t ref) {
+        float offset = hiprt::ptr(centroids[ref])[bestAxis] - axisMin;
+        return std::min(binCount - 1, static_cast<uint32_t>(offset * scale)) < bestBin;
+    });
+    return static_cast<uint32_t>(mid - refs);
+}
+
+// Nodes of a subtree built by one task, nodes[0] is the subtree root. Children that went to tasks of their own are
+// listed in spawned with the node that stands in for their root.
+struct BuildFragment
+{
+    std::vector<BvhNode> nodes;
+    std::vector<std::pair<uint32_t, std::unique_ptr<BuildFragment>>> spawned;
+};
+
+void BuildSubtree(const std::vector<hiprt::Aabb>& boxes,
+                  const std::vector<float3>& centroids,
+                  const BvhBuildOptions& options,
+                  uint32_t* primIndices,
+                  const BuildTask& root,
+                  BuildFragment& fragment,
+                  TaskPool& pool,
+                  uint32_t worker)
+{
+    // task.node is local to the fragment here
+    std::vector<Bin> bins;
+    std::vector<BuildTask> stack;
+    fragment.nodes.emplace_back();
+    stack.push_back({0, root.begin, root.end, root.depth});
+
+    while (!stack.empty())
+    {
+        const BuildTask task = stack.back();
+        stack.pop_back();
+
+        uint32_t* refs = primIndices + task.begin;
+        const uint32_t count = task.end - task.begin;
+
+        RangeBounds bounds = ComputeRangeBounds(boxes, centroids, refs, count, options);
+        fragment.nodes[task.node].box = bounds.box;
+
+        const uint32_t split = SplitRange(boxes, centroids, refs, count, task.depth, bounds, options, bins);
+        if (split == 0)
+        {
+            fragment.nodes[task.node].primOffset = task.begin;
+            fragment.nodes[task.node].primCount = count;
+            continue;
+        }
+
+        const uint32_t left = static_cast<uint32_t>(fragment.nodes.size());
+        fragment.nodes.emplace_back();
+        fragment.nodes.emplace_back();
+        fragment.nodes[task.node].child[0] = left;
+        fragment.nodes[task.node].child[1] = left + 1;
+        fragment.nodes[left].parent = task.node;
+        fragment.nodes[left + 1].parent = task.node;
+
+        const BuildTask rightTask{left + 1, task.begin + split, task.end, task.depth + 1};
+        if (rightTask.end - rightTask.begin >= SubtreeTaskSize)
+        {
+            fragment.spawned.emplace_back(left + 1, std::make_unique<BuildFragment>());
+            BuildFragment& child = *fragment.spawned.back().second;
+            pool.Push(worker, [&boxes, &centroids, &options, primIndices, rightTask, &child, &pool](uint32_t childWorker) {
+                BuildSubtree(boxes, centroids, options, primIndices, rightTask, child, pool, childWorker);
+            });
+        }
+        else
+        {
+            stack.push_back(rightTask);
+        }
+        stack.push_back({left, task.begin, task.begin + split, task.depth + 1});
+    }
+}
+
+// Copies a fragment into nodes with its root at rootIndex, the spawned fragments follow depth first
+void MergeFragment(const BuildFragment& fragment, uint32_t rootIndex, uint32_t parent, std::vector<BvhNode>& nodes)
+{
+    const uint32_t base = static_cast<uint32_t>(nodes.size()) - 1;
+    auto globalIndex = [&](uint32_t local) { return local == 0 ? rootIndex : base + local; };
+
+    nodes.resize(base + fragment.nodes.size());
+    for (uint32_t local = 0; local < fragment.nodes.size(); local++)
+    {
+        BvhNode node = fragment.nodes[local];
+        node.parent = local == 0 ? parent : globalIndex(node.parent);
+        // the stand-ins of spawned fragments have no children yet, their roots overwrite them below
+        if (!node.IsLeaf() && node.child[0] != InvalidNodeIndex)
+        {
+            node.child[0] = globalIndex(node.child[0]);
+            node.child[1] = globalIndex(node.child[1]);
+        }
+        nodes[globalIndex(local)] = node;
+    }
+
+    for (const auto& [local, child] : fragment.spawned) MergeFragment(*child, globalIndex(local), nodes[globalIndex(local)].parent, nodes);
+}
+
+} // namespace
+
+bool BuildBvh(const std::vector<hiprt::Aabb>& primBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch)
+{
+    switch (options.buildType)
+    {
+    case BVH_BUILD_TYPE::BINNED_SAH:
+        return BuildBvhBinnedSah(primBoxes, options, bvh, scratch);
+    case BVH_BUILD_TYPE::LINEAR:
+        return BuildBvhLinear(primBoxes, options, bvh, scratch);
+    case BVH_BUILD_TYPE::SPATIAL_SPLITS:
+        std::cerr << "Bvh build: spatial splits need the triangles, use BuildTriangleBvh\n";
+        break;
+    default:
+        std::cerr << "Bvh build: unknown build type\n";
+    }
+    return false;
+}
+
+bool BuildTriangleBvh(const float3* vertices,
+                      const uint3* indices,
+                      uint32_t triangleCount,
+                      const std::vector<hiprt::Aabb>& triangleBoxes,
+                      const BvhBuildOptions& options,
+                      Bvh& bvh,
+                      BvhBuildScratch* scratch)
+{
+    if (options.buildType == BVH_BUILD_TYPE::SPATIAL_SPLITS)
+        return BuildBvhSpatialSplits(vertices, indices, triangleCount, options, bvh, scratch);
+    if (options.quadPrimitives)
+        return BuildQuadBvh(indices, triangleCount, triangleBoxes, options, bvh, scratch);
+    return BuildBvh(triangleBoxes, options, bvh, scratch);
+}
+
+bool BuildBvhBinnedSah(const std::vector<hiprt::Aabb>& primBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch)
+{
+    bvh.nodes.clear();
+    bvh.primIndices.clear();
+
+    if (primBoxes.empty())
+    {
+        std::cerr << "Bvh build: no primitives\n";
+        return false;
+    }
+    if (options.binCount < 2 || options.maxLeafSize == 0)
+    {
+        std::cerr << "Bvh build: invalid build options\n";
+        return false;
+    }
+
+    const uint32_t primCount = static_cast<uint32_t>(primBoxes.size());
+
+    BvhBuildScratch localScratch;
+    std::vector<float3>& centroids = scratch != nullptr ? scratch->centroids : localScratch.centroids;
+    centroids.resize(primCount);
+    ParallelFor(ChunkCount(primCount), [&](uint32_t chunk, uint32_t) {
+        for (uint32_t i = chunk * ChunkSize; i < std::min(primCount, (chunk + 1) * ChunkSize); i++) centroids[i] = primBoxes[i].center();
+    });
+
+    bvh.primIndices.resize(primCount);
+    std::iota(bvh.primIndices.begin(), bvh.primIndices.end(), 0u);
+
+    bvh.nodes.emplace_back();
+
+    // Top levels: one node at a time with the binning spread over all cores. Ranges that fit under parallelThreshold
+    // are left to subtree tasks, in the order they are reached.
+    std::vector<Bin> bins;
+    std::vector<BuildTask> stack;
+    std::vector<BuildTask> subtrees;
+    stack.push_back({0, 0, primCount, 0});
+
+    while (!stack.empty())
+    {
+        const BuildTask task = stack.back();
+        stack.pop_back();
+
+        const uint32_t count = task.end - task.begin;
+        if (count <= options.parallelThreshold)
+        {
+            subtrees.push_back(task);
+            continue;
+        }
+        if (bvh.nodes.capacity() < 2 * primCount - 1)
+            bvh.nodes.reserve(2 * primCount - 1);
+
+        uint32_t* refs = bvh.primIndices.data() + task.begin;
+        RangeBounds bounds = ComputeRangeBounds(primBoxes, centroids, refs, count, options);
+        bvh.nodes[task.node].box = bounds.box;
+
+        const uint32_t split = SplitRange(primBoxes, centroids, refs, count, task.depth, bounds, options, bins);
+        if (split == 0)
+        {
+            bvh.nodes[task.node].primOffset = task.begin;
+            bvh.nodes[task.node].primCount = count;
+            continue;
+        }
+
+        const uint32_t left = static_cast<uint32_t>(bvh.nodes.size());
+        bvh.nodes.emplace_back();
+        bvh.nodes.emplace_back();
+        bvh.nodes[task.node].child[0] = left;
+        bvh.nodes[task.node].child[1] = left + 1;
+        bvh.nodes[left].parent = task.node;
+        bvh.nodes[left + 1].parent = task.node;
+
+        stack.push_back({left + 1, task.begin + split, task.end, task.depth + 1});
+        stack.push_back({left, task.begin, task.begin + split, task.depth + 1});
+    }
+
+    // Subtrees are built as work stealing tasks, each into its own fragment. Where a fragment hands a large child to a
+    // new task is decided by the primitive count only, and the fragments are stitched together in tree order below,
+    // so the result is the same for any number of workers.
+    // builds that are a single subtree task run on the calling thread
+    TaskPool pool(std::min(GetWorkerCount(), primCount / SubtreeTaskSize + 1));
+    std::vector<BuildFragment> fragments(subtrees.size());
+    for (uint32_t i = 0; i < subtrees.size(); i++)
+    {
+        const BuildTask task = subtrees[i];
+        pool.Push(i, [&, task, i](uint32_t worker) { BuildSubtree(primBoxes, centroids, options, bvh.primIndices.data(), task, fragments[i], pool, worker); });
+    }
+    pool.Run();
+
+    // a tree that is one fragment is taken over as it is
+    if (subtrees.size() == 1 && subtrees[0].node == 0 && fragments[0].spawned.empty())
+    {
+        bvh.nodes.swap(fragments[0].nodes);
+        return true;
+    }
+    for (uint32_t i = 0; i < subtrees.size(); i++) MergeFragment(fragments[i], subtrees[i].node, bvh.nodes[subtrees[i].node].parent, bvh.nodes);
+
+    return true;
+}
+
+float ComputeSahCost(const Bvh& bvh, const BvhBuildOptions& options)
+{
+    if (bvh.nodes.empty())
+        return 0.0f;
+
+    double cost = 0.0;
+    for (const auto& node : bvh.nodes)
+    {
+        if (node.IsLeaf())
+            cost += node.box.area() * options.intersectionCost * node.primCount;
+        else
+            cost += node.box.area() * options.traversalCost;
+    }
+    return static_cast<float>(cost / bvh.nodes[0].box.area());
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Aabb.h"
+
+#include <filesystem>
+#include <vector>
+
+constexpr uint32_t InvalidNodeIndex = ~0u;
+// deep enough for the 63 bit morton codes of the linear builder (63 key bits + 32 bits of index tie break)
+constexpr uint32_t MaxBvhDepth = 128;
+
+enum class BVH_BUILD_TYPE : uint32_t
+{
+    BINNED_SAH = 0,
+    LINEAR,
+    SPATIAL_SPLITS,
+
+    BVH_BUILD_TYPE_COUNT
+};
+
+struct BvhNode
+{
+    hiprt::Aabb box;
+    uint32_t child[2]{InvalidNodeIndex, InvalidNodeIndex};
+    uint32_t parent{InvalidNodeIndex};
+    uint32_t primOffset{0}; // leaf range in Bvh::primIndices
+    uint32_t primCount{0};  // 0 for inner nodes
+
+    bool IsLeaf() const { return primCount > 0; }
+};
+
+struct BvhBuildOptions
+{
+    BVH_BUILD_TYPE buildType{BVH_BUILD_TYPE::BINNED_SAH};
+    uint32_t binCount{16};
+    uint32_t maxLeafSize{4};
+    float traversalCost{1.0f};
+    float intersectionCost{1.0f};
+    // nodes with more primitives than this are binned on all cores, smaller ones are built as work stealing subtree tasks
+    uint32_t parallelThreshold{1u << 15};
+    // linear builder, 30 or 63
+    uint32_t mortonCodeBits{30};
+    // spatial splits are tried when the object split children overlap more than alpha * root area
+    float spatialSplitAlpha{1e-5f};
+    // extra triangle references the spatial split builder may create, relative to the triangle count
+    float duplicationBudget{0.3f};
+    // triangles that share an edge are paired into quads that the builder treats as one primitive, see BuildQuadBvh.
+    // maxLeafSize keeps counting triangles. Spatial splits clip single triangles and ignore it.
+    bool quadPrimitives{true};
+    // host geometry is collapsed to a Bvh8 and traversed with the wide slab test
+    bool wideBvh{true};
+    // the Bvh8 is further quantized to CompressedBvh8 nodes, about a third of the memory
+    bool compressWideBvh{false};
+    // leaves of host geometry are packed into Triangle8 blocks and intersected eight triangles at a time
+    bool triangleLeaves{true};
+    // rounds of treelet restructuring after the build of host geometry, 0 keeps the tree as built
+    uint32_t treeletRounds{0};
+    // host geometry nodes are stored depth first with the larger child next to its parent, see ReorderBvhDepthFirst
+    bool depthFirstLayout{true};
+    // host geometry Bvhs are loaded from and stored to this directory, keyed by ComputeBvhCacheKey. Empty builds every time.
+    std::filesystem::path cacheDirectory;
+    // oriented boxes are fitted to the instance hierarchy and to the top levels of host geometry, see BuildBvhObbs
+    bool orientedTlas{true};
+    uint32_t orientedBlasLevels{4};
+    // cost of a ray-Obb test in ray-Aabb tests, an oriented box is kept only where its tighter fit pays for this
+    float orientedBoxCost{2.0f};
+};
+
+// Flat binary hierarchy, nodes[0] is the root
+struct Bvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primIndices;
+};
+
+// Two triangles that share an edge, a quad to the builder. tri[1] is InvalidNodeIndex for a triangle left alone.
+struct TrianglePair
+{
+    uint32_t tri[2];
+};
+
+// Per primitive work buffers of the builders that outlive one build. A worker that runs a batch of builds passes the same
+// scratch to all of them, the buffers keep their capacity and only a build larger than every one before it allocates.
+// The outputs (nodes, primIndices) and the per node bins are not part of it.
+struct BvhBuildScratch
+{
+    // binned SAH
+    std::vector<float3> centroids;
+    // linear, the morton codes of 30 and 63 bit keys
+    std::vector<uint32_t> mortonCodes32;
+    std::vector<uint64_t> mortonCodes64;
+    // spatial splits, the areas of the right to left sweeps
+    std::vector<float> sweepAreas;
+    // triangle pairing, per half edge and per triangle
+    std::vector<uint64_t> edgeKeys;
+    std::vector<uint32_t> halfEdges;
+    std::vector<uint32_t> neighbours;
+    std::vector<uint8_t> paired;
+    std::vector<TrianglePair> pairs;
+    std::vector<hiprt::Aabb> pairBoxes;
+    // the ping-pong buffers of the radix sorts of the linear builder and of the pairing
+    std::vector<uint32_t> radixKeys32;
+    std::vector<uint64_t> radixKeys64;
+    std::vector<uint32_t> radixValues;
+};
+
+bool BuildBvh(const std::vector<hiprt::Aabb>& primBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch = nullptr);
+
+// same as BuildBvh, but builders that clip the geometry (spatial splits) get the triangles as well
+bool BuildTriangleBvh(const float3* vertices,
+                      const uint3* indices,
+                      uint32_t triangleCount,
+                      const std::vector<hiprt::Aabb>& triangleBoxes,
+                      const BvhBuildOptions& options,
+                      Bvh& bvh,
+                      BvhBuildScratch* scratch = nullptr);
+
+bool BuildBvhBinnedSah(const std::vector<hiprt::Aabb>& primBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch = nullptr);
+
+// one primitive per leaf, built from sorted morton codes of the box centers
+bool BuildBvhLinear(const std::vector<hiprt::Aabb>& primBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch = nullptr);
+
+// SBVH, a triangle can be referenced from several leaves so primIndices may be longer than the triangle count
+bool BuildBvhSpatialSplits(const float3* vertices, const uint3* indices, uint32_t triangleCount, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch = nullptr);
+
+// SAH cost of the whole tree normalized by the root area
+float ComputeSahCost(const Bvh& bvh, const BvhBuildOptions& options);
+
+// Rearranges treelets of up to 7 subtrees into their cheapest SAH topology, options.treeletRounds passes bottom-up.
+// Leaves and primIndices stay as they are, so it runs after any builder. A treelet is not rewritten if the new topology
+// would reach MaxBvhDepth, and false is returned when the tree is already too deep. sahBefore and sahAfter receive
+// ComputeSahCost.
+bool OptimizeBvhTreelets(Bvh& bvh, const BvhBuildOptions& options, float* sahBefore = nullptr, float* sahAfter = nullptr);
+
+// Keeps the topology and primIndices and recomputes every box bottom-up from new boxes of the same primitives
+bool RefitBvh(const std::vector<hiprt::Aabb>& primBoxes, Bvh& bvh);
+
+// SAH cost of a refitted tree relative to its cost right after the full build. Starts at 1 and grows as the
+// primitives move away from the positions the tree was built for; rebuilding around 1.5 - 2 is a common choice.
+float ComputeRefitDegradation(const Bvh& bvh, float buildSahCost, const BvhBuildOptions& options);
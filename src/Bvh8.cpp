@@ -0,0 +1,132 @@
+#include "Bvh8.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+void SetChild(Bvh8Node& node, uint32_t slot, const BvhNode& child, uint32_t childIndex)
+{
+    node.minX[slot] = child.box.m_min.x;
+    node.minY[slot] = child.box.m_min.y;
+    node.minZ[slot] = child.box.m_min.z;
+    node.maxX[slot] = child.box.m_max.x;
+    node.maxY[slot] = child.box.m_max.y;
+    node.maxZ[slot] = child.box.m_max.z;
+    node.child[slot] = child.IsLeaf() ? child.primOffset : childIndex;
+    node.primCount[slot] = child.primCount;
+}
+
+void ResetNode(Bvh8Node& node)
+{
+    // unused slots get an empty box, they are masked out by childCount anyway
+    const float maxValue = std::numeric_limits<float>::max();
+    for (uint32_t i = 0; i < Bvh8Width; i++)
+    {
+        node.minX[i] = node.minY[i] = node.minZ[i] = maxValue;
+        node.maxX[i] = node.maxY[i] = node.maxZ[i] = -maxValue;
+        node.child[i] = InvalidNodeIndex;
+        node.primCount[i] = 0;
+    }
+    node.childCount = 0;
+}
+
+} // namespace
+
+bool CollapseBvh8(const Bvh& bvh, Bvh8& bvh8, std::vector<uint32_t>* wideNodes)
+{
+    bvh8.nodes.clear();
+    bvh8.primIndices = bvh.primIndices;
+    if (wideNodes)
+        wideNodes->assign(bvh.nodes.size(), 0);
+
+    if (bvh.nodes.empty())
+    {
+        std::cerr << "Bvh8 collapse: empty bvh\n";
+        return false;
+    }
+
+    bvh8.nodes.reserve(bvh.nodes.size() / 4 + 1);
+    bvh8.nodes.emplace_back();
+    ResetNode(bvh8.nodes[0]);
+
+    if (bvh.nodes[0].IsLeaf())
+    {
+        SetChild(bvh8.nodes[0], 0, bvh.nodes[0], 0);
+        bvh8.nodes[0].childCount = 1;
+        return true;
+    }
+
+    struct CollapseTask
+    {
+        uint32_t binaryNode;
+        uint32_t wideNode;
+    };
+    std::vector<CollapseTask> stack;
+    stack.push_back({0, 0});
+
+    uint32_t children[Bvh8Width];
+    while (!stack.empty())
+    {
+        const CollapseTask task = stack.back();
+        stack.pop_back();
+
+        const BvhNode& node = bvh.nodes[task.binaryNode];
+        if (wideNodes)
+            (*wideNodes)[task.binaryNode] = task.wideNode;
+        uint32_t childCount = 2;
+        children[0] = node.child[0];
+        children[1] = node.child[1];
+
+        // open the largest inner child until the node is full
+        while (childCount < Bvh8Width)
+        {
+            uint32_t best = InvalidNodeIndex;
+            float bestArea = -1.0f;
+            for (uint32_t i = 0; i < childCount; i++)
+            {
+                const BvhNode& child = bvh.nodes[children[i]];
+                if (!child.IsLeaf() && child.box.area() > bestArea)
+                {
+                    bestArea = child.box.area();
+                    best = i;
+                }
+            }
+            if (best == InvalidNodeIndex)
+                break;
+
+            const BvhNode& opened = bvh.nodes[children[best]];
+            if (wideNodes)
+                (*wideNodes)[children[best]] = task.wideNode;
+            children[best] = opened.child[0];
+            children[childCount++] = opened.child[1];
+        }
+
+        // largest child first, the occlusion traversal visits the children in slot order
+        std::sort(children, children + childCount, [&](uint32_t a, uint32_t b) { return bvh.nodes[a].box.area() > bvh.nodes[b].box.area(); });
+
+        const size_t firstTask = stack.size();
+        for (uint32_t i = 0; i < childCount; i++)
+        {
+            const BvhNode& child = bvh.nodes[children[i]];
+            uint32_t childIndex = InvalidNodeIndex;
+            if (child.IsLeaf() && wideNodes)
+                (*wideNodes)[children[i]] = task.wideNode;
+            if (!child.IsLeaf())
+            {
+                childIndex = static_cast<uint32_t>(bvh8.nodes.size());
+                bvh8.nodes.emplace_back();
+                ResetNode(bvh8.nodes.back());
+                stack.push_back({children[i], childIndex});
+            }
+            SetChild(bvh8.nodes[task.wideNode], i, child, childIndex);
+        }
+        bvh8.nodes[task.wideNode].childCount = childCount;
+
+        // the first (largest) inner child is collapsed next, so its children are stored right after this sibling block
+        std::reverse(stack.begin() + firstTask, stack.end());
+    }
+
+    return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+
+#include <vector>
+
+#if defined(__AVX2__)
+#    include <immintrin.h>
+#endif
+
+constexpr uint32_t Bvh8Width = 8;
+
+// Eight child boxes in SoA layout so one slab test covers all children.
+// child[i] is a node index for inner children and an offset into Bvh8::primIndices for leaves (primCount[i] > 0).
+// Children are packed from slot 0, slots past childCount are unused.
+struct alignas(32) Bvh8Node
+{
+    float minX[Bvh8Width];
+    float minY[Bvh8Width];
+    float minZ[Bvh8Width];
+    float maxX[Bvh8Width];
+    float maxY[Bvh8Width];
+    float maxZ[Bvh8Width];
+    uint32_t child[Bvh8Width];
+    uint32_t primCount[Bvh8Width];
+    uint32_t childCount;
+};
+
+// nodes[0] is the root, it has no box of its own
+struct Bvh8
+{
+    std::vector<Bvh8Node> nodes;
+    std::vector<uint32_t> primIndices;
+};
+
+inline uint32_t ChildIndex(const Bvh8Node& node, uint32_t slot)
+{
+    return node.child[slot];
+}
+
+inline uint32_t ChildPrimCount(const Bvh8Node& node, uint32_t slot)
+{
+    return node.primCount[slot];
+}
+
+// Collapses a binary Bvh into 8 wide nodes by repeatedly opening the inner child with the largest surface area.
+// The children of a node are sorted by decreasing surface area. wideNodes, when given, receives for every binary node
+// the Bvh8 node that it became or that absorbed it (the parent node for leaves).
+bool CollapseBvh8(const Bvh& bvh, Bvh8& bvh8, std::vector<uint32_t>* wideNodes = nullptr);
+
+struct Bvh8Ray
+{
+    float3 invD;
+    float3 oxInvD;
+};
+
+inline Bvh8Ray MakeBvh8Ray(const hiprtRay& ray)
+{
+    Bvh8Ray r;
+    r.invD = hiprt::safeInv(ray.direction);
+    r.oxInvD = -ray.origin * r.invD;
+    return r;
+}
+
+// Slab test against all children of the node, returns a bit per hit child and the entry distances in tNear
+inline uint32_t IntersectChildren(const Bvh8Node& node, const Bvh8Ray& ray, float maxT, float* tNear)
+{
+#if defined(__AVX2__)
+    auto slab = [](const float* p, __m256 invD, __m256 oxInvD) {
+#    if defined(__FMA__) || defined(_MSC_VER)
+        return _mm256_fmadd_ps(_mm256_load_ps(p), invD, oxInvD);
+#    else
+        return _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(p), invD), oxInvD);
+#    endif
+    };
+
+    const __m256 invDx = _mm256_set1_ps(ray.invD.x);
+    const __m256 invDy = _mm256_set1_ps(ray.invD.y);
+    const __m256 invDz = _mm256_set1_ps(ray.invD.z);
+    const __m256 oxInvDx = _mm256_set1_ps(ray.oxInvD.x);
+    const __m256 oxInvDy = _mm256_set1_ps(ray.oxInvD.y);
+    const __m256 oxInvDz = _mm256_set1_ps(ray.oxInvD.z);
+
+    const __m256 x0 = slab(node.minX, invDx, oxInvDx);
+    const __m256 x1 = slab(node.maxX, invDx, oxInvDx);
+    const __m256 y0 = slab(node.minY, invDy, oxInvDy);
+    const __m256 y1 = slab(node.maxY, invDy, oxInvDy);
+    const __m256 z0 = slab(node.minZ, invDz, oxInvDz);
+    const __m256 z1 = slab(node.maxZ, invDz, oxInvDz);
+
+    __m256 t0 = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_max_ps(_mm256_min_ps(z0, z1), _mm256_setzero_ps()));
+    __m256 t1 = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_min_ps(_mm256_max_ps(z0, z1), _mm256_set1_ps(maxT)));
+
+    _mm256_storeu_ps(tNear, t0);
+    const uint32_t hits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)));
+#else
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < node.childCount; i++)
+    {
+        hiprt::Aabb box(make_float3(node.minX[i], node.minY[i], node.minZ[i]), make_float3(node.maxX[i], node.maxY[i], node.maxZ[i]));
+        float2 t = box.intersect(ray.invD, ray.oxInvD, maxT);
+        tNear[i] = t.x;
+        if (t.x <= t.y)
+            hits |= 1u << i;
+    }
+#endif
+    return hits & ((1u << node.childCount) - 1);
+}
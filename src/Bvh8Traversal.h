@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Bvh8.h"
+
+#include <bit>
+
+// Stack based traversal of a Bvh8 or CompressedBvh8. All children of a node are tested at once and the hit ones are
+// visited front to back: the nearest continues right away, the rest are pushed farthest first.
+// leafFunc(primOffset, primCount, maxT) has the same contract as in TraverseBvhLeaves.
+template<typename WideBvh, typename LeafFunc>
+void TraverseBvh8Leaves(const WideBvh& bvh, const hiprtRay& ray, float& maxT, LeafFunc&& leafFunc)
+{
+    if (bvh.nodes.empty())
+        return;
+
+    const Bvh8Ray wideRay = MakeBvh8Ray(ray);
+
+    struct StackEntry
+    {
+        uint32_t child;
+        uint32_t primCount;
+        float t;
+    };
+    StackEntry stack[MaxBvhDepth * (Bvh8Width - 1)];
+    uint32_t stackSize = 0;
+    StackEntry current{0, 0, 0.0f};
+
+    alignas(32) float tNear[Bvh8Width];
+    StackEntry hits[Bvh8Width];
+
+    while (true)
+    {
+        if (current.primCount > 0)
+        {
+            if (leafFunc(current.child, current.primCount, maxT))
+                return;
+        }
+        else
+        {
+            const auto& node = bvh.nodes[current.child];
+            uint32_t mask = IntersectChildren(node, wideRay, maxT, tNear);
+            if (mask != 0)
+            {
+                // insertion sort of the hit children by entry distance, farthest first
+                uint32_t hitCount = 0;
+                while (mask != 0)
+                {
+                    const uint32_t slot = static_cast<uint32_t>(std::countr_zero(mask));
+                    mask &= mask - 1;
+
+                    const StackEntry entry{ChildIndex(node, slot), ChildPrimCount(node, slot), tNear[slot]};
+                    uint32_t j = hitCount++;
+                    while (j > 0 && hits[j - 1].t < entry.t)
+                    {
+                        hits[j] = hits[j - 1];
+                        j--;
+                    }
+                    hits[j] = entry;
+                }
+
+                for (uint32_t i = 0; i + 1 < hitCount; i++) stack[stackSize++] = hits[i];
+                current = hits[hitCount - 1];
+                continue;
+            }
+        }
+
+        // skip entries that a closer hit has moved out of range
+        do
+        {
+            if (stackSize == 0)
+                return;
+            --stackSize;
+        } while (stack[stackSize].t > maxT);
+        current = stack[stackSize];
+    }
+}
+
+// leafFunc(primIndex, maxT) has the same contract as in TraverseBvh
+template<typename WideBvh, typename LeafFunc>
+void TraverseBvh8(const WideBvh& bvh, const hiprtRay& ray, float& maxT, LeafFunc&& leafFunc)
+{
+    TraverseBvh8Leaves(bvh, ray, maxT, [&](uint32_t primOffset, uint32_t primCount, float& leafMaxT) {
+        for (uint32_t i = 0; i < primCount; i++)
+        {
+            if (leafFunc(bvh.primIndices[primOffset + i], leafMaxT))
+                return true;
+        }
+        return false;
+    });
+}
+
+// Occlusion query of a Bvh8 or CompressedBvh8, stops at the first primitive the ray hits within maxT. The order only
+// matters for occluded rays, so the hit children are not sorted by distance: leaves are tested right away and the
+// inner children are visited largest first, which is their slot order (CollapseBvh8).
+// leafFunc(primOffset, primCount) returns true when one of the primitives of the leaf blocks the ray. rootIndex starts
+// the traversal in a subtree.
+template<typename WideBvh, typename LeafFunc>
+bool TraverseBvh8Occlusion(const WideBvh& bvh, const hiprtRay& ray, float maxT, LeafFunc&& leafFunc, uint32_t rootIndex = 0)
+{
+    if (bvh.nodes.empty())
+        return false;
+
+    const Bvh8Ray wideRay = MakeBvh8Ray(ray);
+
+    uint32_t stack[MaxBvhDepth * (Bvh8Width - 1)];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = rootIndex;
+
+    alignas(32) float tNear[Bvh8Width];
+
+    while (true)
+    {
+        const auto& node = bvh.nodes[nodeIndex];
+        uint32_t mask = IntersectChildren(node, wideRay, maxT, tNear);
+
+        uint32_t innerMask = 0;
+        for (; mask != 0; mask &= mask - 1)
+        {
+            const uint32_t slot = static_cast<uint32_t>(std::countr_zero(mask));
+            const uint32_t primCount = ChildPrimCount(node, slot);
+            if (primCount == 0)
+                innerMask |= 1u << slot;
+            else if (leafFunc(ChildIndex(node, slot), primCount))
+                return true;
+        }
+
+        // pushed last slot first, the first (largest) one is popped next
+        while (innerMask != 0)
+        {
+            const uint32_t slot = 31 - static_cast<uint32_t>(std::countl_zero(innerMask));
+            innerMask &= ~(1u << slot);
+            stack[stackSize++] = ChildIndex(node, slot);
+        }
+
+        if (stackSize == 0)
+            return false;
+        nodeIndex = stack[--stackSize];
+    }
+}
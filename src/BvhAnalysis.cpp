@@ -0,0 +1,270 @@
+// HIPRT-AO-BvhStats: builds the host geometry of one mesh with every build strategy and writes the quality of the trees
+// as JSON, for comparing builders and for catching regressions in CI.
+//
+//   HIPRT-AO-BvhStats <mesh.obj|mesh.stl> <report.json> [rayCount]
+
+#include "../kernels/shared.h"
+#include "BvhLayout.h"
+#include "BvhStats.h"
+#include "BvhTraversal.h"
+#include "HostScene.h"
+#include "MeshReader.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+struct AnalysisVariant
+{
+    const char* name;
+    BvhBuildOptions options;
+};
+
+std::vector<AnalysisVariant> CreateVariants()
+{
+    std::vector<AnalysisVariant> variants;
+    BvhBuildOptions options;
+    variants.push_back({"binned_sah", options});
+
+    options.quadPrimitives = false;
+    variants.push_back({"binned_sah_triangles", options});
+    options.quadPrimitives = true;
+
+    options.treeletRounds = 2;
+    variants.push_back({"binned_sah_treelets", options});
+
+    options = BvhBuildOptions{};
+    options.buildType = BVH_BUILD_TYPE::LINEAR;
+    variants.push_back({"linear_30", options});
+    options.mortonCodeBits = 63;
+    variants.push_back({"linear_63", options});
+
+    options = BvhBuildOptions{};
+    options.buildType = BVH_BUILD_TYPE::SPATIAL_SPLITS;
+    variants.push_back({"spatial_splits", options});
+    return variants;
+}
+
+// Closest hit rays from uniform points in the scene bounds in uniform directions, the same set for every variant
+std::vector<hiprtRay> CreateRays(const hiprt::Aabb& bounds, uint32_t rayCount)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    const float3 extent = bounds.m_max - bounds.m_min;
+
+    std::vector<hiprtRay> rays(rayCount);
+    for (hiprtRay& ray : rays)
+    {
+        ray.origin = bounds.m_min + make_float3(uniform(rng), uniform(rng), uniform(rng)) * extent;
+        const float z = 2.0f * uniform(rng) - 1.0f;
+        const float phi = 2.0f * hiprt::Pi * uniform(rng);
+        const float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+        ray.direction = make_float3(r * cosf(phi), r * sinf(phi), z);
+        ray.minT = 0.0f;
+        ray.maxT = 1.0e30f;
+    }
+    return rays;
+}
+
+// Node fetches of the binary tree, the layout independent work of a traversal
+struct CountedNodes
+{
+    const std::vector<BvhNode>& nodes;
+    uint64_t& fetches;
+
+    bool empty() const { return nodes.empty(); }
+
+    const BvhNode& operator[](size_t index) const
+    {
+        fetches++;
+        return nodes[index];
+    }
+};
+
+struct CountedBvh
+{
+    CountedNodes nodes;
+    const std::vector<uint32_t>& primIndices;
+};
+
+struct TraversalStats
+{
+    double nodeFetchesPerRay{0.0};
+    double primitiveTestsPerRay{0.0};
+    float nodeCacheMissesPerRay{0.0f};
+};
+
+void MeasureTraversal(const HostScene& scene, const std::vector<hiprtRay>& rays, TraversalStats& stats)
+{
+    uint64_t fetches = 0;
+    uint64_t tests = 0;
+    for (const hiprtRay& ray : rays)
+    {
+        float closest = ray.maxT;
+        for (const HostGeometry& geometry : scene.geometries)
+        {
+            TraverseBvh(CountedBvh{{geometry.bvh.nodes, fetches}, geometry.bvh.primIndices}, ray, closest, [&](uint32_t primIndex, float& maxT) {
+                const uint3& t = geometry.indices[primIndex];
+                hiprtHit hit;
+                tests++;
+                if (IntersectTriangle(ray, geometry.vertices[t.x], geometry.vertices[t.y], geometry.vertices[t.z], maxT, hit))
+                    maxT = hit.t;
+                return false;
+            });
+        }
+    }
+
+    stats.nodeFetchesPerRay = static_cast<double>(fetches) / rays.size();
+    stats.primitiveTestsPerRay = static_cast<double>(tests) / rays.size();
+    MeasureNodeCacheMisses(scene, rays, NodeCacheModel{}, stats.nodeCacheMissesPerRay);
+}
+
+std::string JsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (const char c : text)
+    {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+std::string JsonArray(const std::vector<uint32_t>& values)
+{
+    std::string array = "[";
+    for (size_t i = 0; i < values.size(); i++) array += (i > 0 ? ", " : "") + std::to_string(values[i]);
+    return array + "]";
+}
+
+template<typename T>
+size_t VectorBytes(const std::vector<T>& v)
+{
+    return v.size() * sizeof(T);
+}
+
+void WriteGeometryJson(std::ostream& out, const HostGeometry& geometry, const BvhStats& stats)
+{
+    const double triangles = std::max(geometry.triangleCount, 1u);
+    const size_t binaryBytes = VectorBytes(geometry.bvh.nodes) + VectorBytes(geometry.bvh.primIndices);
+    const size_t wideBytes = VectorBytes(geometry.bvh8.nodes) + VectorBytes(geometry.bvh8.primIndices) + VectorBytes(geometry.compressedBvh8.nodes) +
+                             VectorBytes(geometry.compressedBvh8.primIndices);
+    const size_t leafBytes = VectorBytes(geometry.triangleLeaves.blocks) + VectorBytes(geometry.triangleLeaves.leafBlocks);
+
+    out << "        {\n";
+    out << "          \"triangles\": " << geometry.triangleCount << ",\n";
+    out << "          \"sah_cost\": " << stats.sahCost << ",\n";
+    out << "          \"nodes\": " << stats.nodeCount << ",\n";
+    out << "          \"inner_nodes\": " << stats.innerCount << ",\n";
+    out << "          \"leaves\": " << stats.leafCount << ",\n";
+    out << "          \"prim_references\": " << stats.primReferenceCount << ",\n";
+    out << "          \"max_depth\": " << stats.maxDepth << ",\n";
+    out << "          \"leaf_depth_histogram\": " << JsonArray(stats.leafDepthHistogram) << ",\n";
+    out << "          \"leaf_size_histogram\": " << JsonArray(stats.leafSizeHistogram) << ",\n";
+    out << "          \"mean_child_overlap\": " << stats.meanChildOverlap << ",\n";
+    out << "          \"sah_overlap\": " << stats.sahOverlap << ",\n";
+    out << "          \"binary_bytes_per_triangle\": " << binaryBytes / triangles << ",\n";
+    out << "          \"wide_bytes_per_triangle\": " << wideBytes / triangles << ",\n";
+    out << "          \"triangle_leaf_bytes_per_triangle\": " << leafBytes / triangles << "\n";
+    out << "        }";
+}
+
+} // namespace
+
+int main(int argc, char const* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <mesh.obj|mesh.stl> <report.json> [rayCount]\n";
+        return 1;
+    }
+    const fs::path meshPath = argv[1];
+    const fs::path reportPath = argv[2];
+    const uint32_t rayCount = argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 1u << 16;
+
+    std::vector<TriangleMesh> meshes;
+    if (meshPath.extension() == ".stl" || meshPath.extension() == ".STL")
+    {
+        meshes.emplace_back();
+        if (ReadStlMesh(meshPath, meshes.back()) == false)
+            return 1;
+    }
+    else if (ReadObjMesh(meshPath, meshPath.parent_path(), meshes) == false)
+    {
+        return 1;
+    }
+
+    uint64_t triangleCount = 0;
+    for (const TriangleMesh& mesh : meshes) triangleCount += mesh.indices.size();
+
+    std::ofstream out(reportPath);
+    if (!out)
+    {
+        std::cerr << "Bvh stats: cannot write " << reportPath.string() << "\n";
+        return 1;
+    }
+
+    out << "{\n";
+    out << "  \"mesh\": " << JsonString(meshPath.string()) << ",\n";
+    out << "  \"geometries\": " << meshes.size() << ",\n";
+    out << "  \"triangles\": " << triangleCount << ",\n";
+    out << "  \"rays\": " << rayCount << ",\n";
+    out << "  \"variants\": [\n";
+
+    std::vector<hiprtRay> rays;
+    const std::vector<AnalysisVariant> variants = CreateVariants();
+    for (size_t v = 0; v < variants.size(); v++)
+    {
+        const AnalysisVariant& variant = variants[v];
+        const auto start = std::chrono::steady_clock::now();
+        HostScene scene;
+        if (CreateHostScene(meshes, variant.options, scene) == false)
+        {
+            std::cerr << "Bvh stats: " << variant.name << " build failed\n";
+            return 1;
+        }
+        const double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (rays.empty() && rayCount > 0)
+        {
+            hiprt::Aabb bounds;
+            for (const HostGeometry& geometry : scene.geometries)
+            {
+                if (!geometry.bvh.nodes.empty())
+                    bounds.grow(geometry.bvh.nodes[0].box);
+            }
+            rays = CreateRays(bounds, rayCount);
+        }
+        TraversalStats traversal;
+        if (!rays.empty())
+            MeasureTraversal(scene, rays, traversal);
+
+        out << "    {\n";
+        out << "      \"name\": " << JsonString(variant.name) << ",\n";
+        out << "      \"build_seconds\": " << buildSeconds << ",\n";
+        out << "      \"node_fetches_per_ray\": " << traversal.nodeFetchesPerRay << ",\n";
+        out << "      \"primitive_tests_per_ray\": " << traversal.primitiveTestsPerRay << ",\n";
+        out << "      \"node_cache_misses_per_ray\": " << traversal.nodeCacheMissesPerRay << ",\n";
+        out << "      \"geometries\": [\n";
+        for (size_t g = 0; g < scene.geometries.size(); g++)
+        {
+            BvhStats stats;
+            if (ComputeBvhStats(scene.geometries[g].bvh, variant.options, stats) == false)
+                return 1;
+            WriteGeometryJson(out, scene.geometries[g], stats);
+            out << (g + 1 < scene.geometries.size() ? ",\n" : "\n");
+        }
+        out << "      ]\n";
+        out << "    }" << (v + 1 < variants.size() ? ",\n" : "\n");
+        std::cout << "Bvh stats: " << variant.name << " done in " << buildSeconds << " s\n";
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+    return out ? 0 : 1;
+}
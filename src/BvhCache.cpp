@@ -0,0 +1,317 @@
+#include "BvhCache.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace {
+
+constexpr uint32_t BvhCacheMagic = 0x48564248; // "HBVH"
+
+// The file is the header followed by the nodes and the primIndices in the in-memory layout and byte order of this
+// build, so both arrays can be used straight from a mapping of the file
+struct BvhCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t nodeSize;
+    uint32_t nodeCount;
+    uint32_t primIndexCount;
+    float buildSahCost;
+    // CacheHasher over the nodes and primIndices, a truncated or overwritten file is a miss and not a broken tree
+    uint64_t checksum;
+};
+
+static_assert(sizeof(BvhCacheHeader) % alignof(BvhNode) == 0 && sizeof(BvhNode) % alignof(uint32_t) == 0, "cache sections must stay aligned in the mapping");
+
+// 64 bit multiply-rotate hash over 8 byte words, a few ms for a mesh of a million triangles
+class CacheHasher
+{
+public:
+    void Add(const void* data, size_t bytes)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (; bytes >= 8; p += 8, bytes -= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            Mix(word);
+        }
+        if (bytes > 0)
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, p, bytes);
+            Mix(word);
+        }
+    }
+
+    template<typename T>
+    void Add(const T& value)
+    {
+        Add(&value, sizeof(T));
+    }
+
+    uint64_t Finish() const
+    {
+        uint64_t h = m_state ^ m_length;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    void Mix(uint64_t word)
+    {
+        m_state ^= word * 0x9e3779b97f4a7c15ull;
+        m_state = ((m_state << 31) | (m_state >> 33)) * 0xc2b2ae3d27d4eb4full;
+        m_length++;
+    }
+
+    uint64_t m_state{0x27d4eb2f165667c5ull};
+    uint64_t m_length{0};
+};
+
+// Read only mapping of a whole file, unmapped when it goes out of scope
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#if defined(_WIN32)
+        if (m_data != nullptr)
+            UnmapViewOfFile(m_data);
+#else
+        if (m_data != nullptr)
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    }
+
+    bool Open(const fs::path& path)
+    {
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr)
+            return false;
+        m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        m_size = static_cast<size_t>(size.QuadPart);
+#else
+        const int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat info;
+        void* data = MAP_FAILED;
+        if (fstat(file, &info) == 0 && info.st_size > 0)
+            data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if (data == MAP_FAILED)
+            return false;
+        m_data = static_cast<const uint8_t*>(data);
+        m_size = static_cast<size_t>(info.st_size);
+#endif
+        return m_data != nullptr;
+    }
+
+    const uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    const uint8_t* m_data{nullptr};
+    size_t m_size{0};
+};
+
+fs::path CacheFilePath(const fs::path& directory, uint64_t key)
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+    return directory / name.str();
+}
+
+uint64_t ComputeChecksum(const BvhNode* nodes, uint32_t nodeCount, const uint32_t* primIndices, uint32_t primIndexCount)
+{
+    CacheHasher hasher;
+    hasher.Add(nodes, sizeof(BvhNode) * nodeCount);
+    hasher.Add(primIndices, sizeof(uint32_t) * primIndexCount);
+    return hasher.Finish();
+}
+
+// the checksum does not protect against a file written by a buggy build, every link is checked once on load so the
+// traversal cannot leave the arrays: the nodes form one tree below nodes[0] no deeper than the traversal stacks, each
+// node reached exactly once and pointing back at its parent
+bool ValidateBvh(const BvhNode* nodes, uint32_t nodeCount, const uint32_t* primIndices, uint32_t primIndexCount, uint32_t triangleCount)
+{
+    if (nodeCount == 0 || nodes[0].parent != InvalidNodeIndex)
+        return false;
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t depth;
+    };
+    std::vector<bool> reached(nodeCount, false);
+    std::vector<Entry> stack{{0, 0}};
+    reached[0] = true;
+    uint32_t reachedCount = 1;
+    while (!stack.empty())
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        const BvhNode& node = nodes[entry.node];
+        if (node.IsLeaf())
+        {
+            if (node.primOffset > primIndexCount || node.primCount > primIndexCount - node.primOffset)
+                return false;
+            continue;
+        }
+        if (entry.depth + 1 >= MaxBvhDepth)
+            return false;
+        for (uint32_t child : node.child)
+        {
+            if (child >= nodeCount || reached[child] || nodes[child].parent != entry.node)
+                return false;
+            reached[child] = true;
+            reachedCount++;
+            stack.push_back({child, entry.depth + 1});
+        }
+    }
+    if (reachedCount != nodeCount)
+        return false;
+    for (uint32_t i = 0; i < primIndexCount; i++)
+    {
+        if (primIndices[i] >= triangleCount)
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+uint64_t ComputeBvhCacheKey(const float3* vertices, uint32_t vertexCount, const uint3* indices, uint32_t triangleCount, const BvhBuildOptions& options)
+{
+    CacheHasher hasher;
+    hasher.Add(BvhCacheVersion);
+    hasher.Add(static_cast<uint32_t>(sizeof(BvhNode)));
+    hasher.Add(vertexCount);
+    hasher.Add(triangleCount);
+    hasher.Add(vertices, sizeof(float3) * vertexCount);
+    hasher.Add(indices, sizeof(uint3) * triangleCount);
+
+    // field by field, the padding of the struct is not part of the key
+    hasher.Add(options.buildType);
+    hasher.Add(options.binCount);
+    hasher.Add(options.maxLeafSize);
+    hasher.Add(options.traversalCost);
+    hasher.Add(options.intersectionCost);
+    hasher.Add(options.mortonCodeBits);
+    hasher.Add(options.spatialSplitAlpha);
+    hasher.Add(options.duplicationBudget);
+    hasher.Add(options.quadPrimitives);
+    hasher.Add(options.treeletRounds);
+    hasher.Add(options.depthFirstLayout);
+    return hasher.Finish();
+}
+
+bool LoadCachedBvh(const fs::path& directory, uint64_t key, uint32_t triangleCount, Bvh& bvh, float& buildSahCost)
+{
+    MappedFile file;
+    if (!file.Open(CacheFilePath(directory, key)) || file.Size() < sizeof(BvhCacheHeader))
+        return false;
+
+    BvhCacheHeader header;
+    std::memcpy(&header, file.Data(), sizeof(header));
+    if (header.magic != BvhCacheMagic || header.version != BvhCacheVersion || header.key != key || header.nodeSize != sizeof(BvhNode))
+        return false;
+    const size_t nodeBytes = static_cast<size_t>(header.nodeCount) * sizeof(BvhNode);
+    const size_t primBytes = static_cast<size_t>(header.primIndexCount) * sizeof(uint32_t);
+    if (file.Size() != sizeof(header) + nodeBytes + primBytes)
+        return false;
+
+    const BvhNode* nodes = reinterpret_cast<const BvhNode*>(file.Data() + sizeof(header));
+    const uint32_t* primIndices = reinterpret_cast<const uint32_t*>(file.Data() + sizeof(header) + nodeBytes);
+    if (header.checksum != ComputeChecksum(nodes, header.nodeCount, primIndices, header.primIndexCount) ||
+        !ValidateBvh(nodes, header.nodeCount, primIndices, header.primIndexCount, triangleCount))
+        return false;
+
+    // Bvh owns its vectors and refit writes to them, so the arrays are taken over with one bulk copy each instead of
+    // being parsed. The pages come from the file cache, a repeated run does no disk reads at all.
+    bvh.nodes.assign(nodes, nodes + header.nodeCount);
+    bvh.primIndices.assign(primIndices, primIndices + header.primIndexCount);
+    buildSahCost = header.buildSahCost;
+    return true;
+}
+
+bool StoreCachedBvh(const fs::path& directory, uint64_t key, const Bvh& bvh, float buildSahCost)
+{
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error)
+    {
+        std::cerr << "Bvh cache: cannot create " << directory.string() << "\n";
+        return false;
+    }
+
+    BvhCacheHeader header;
+    header.magic = BvhCacheMagic;
+    header.version = BvhCacheVersion;
+    header.key = key;
+    header.nodeSize = sizeof(BvhNode);
+    header.nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+    header.primIndexCount = static_cast<uint32_t>(bvh.primIndices.size());
+    header.buildSahCost = buildSahCost;
+    header.checksum = ComputeChecksum(bvh.nodes.data(), header.nodeCount, bvh.primIndices.data(), header.primIndexCount);
+
+    const fs::path path = CacheFilePath(directory, key);
+    fs::path temporary = path;
+    temporary += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(bvh.nodes.data()), static_cast<std::streamsize>(bvh.nodes.size() * sizeof(BvhNode)));
+        out.write(reinterpret_cast<const char*>(bvh.primIndices.data()), static_cast<std::streamsize>(bvh.primIndices.size() * sizeof(uint32_t)));
+        if (!out)
+        {
+            std::cerr << "Bvh cache: cannot write " << temporary.string() << "\n";
+            out.close();
+            fs::remove(temporary, error);
+            return false;
+        }
+    }
+
+    fs::rename(temporary, path, error);
+    if (error)
+    {
+        std::cerr << "Bvh cache: cannot replace " << path.string() << "\n";
+        fs::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Bumped whenever BvhNode, the file layout or a builder changes the trees it produces for the same input
+constexpr uint32_t BvhCacheVersion = 1;
+
+// Key of a finished host geometry Bvh: the vertex and index buffers and the options that shape the tree. Options that
+// only change how the build is scheduled (parallelThreshold) or what is derived from the tree afterwards (wide layouts,
+// triangle leaves) are left out, those are rebuilt from the binary tree on load.
+uint64_t ComputeBvhCacheKey(const float3* vertices, uint32_t vertexCount, const uint3* indices, uint32_t triangleCount, const BvhBuildOptions& options);
+
+// Maps <directory>/<key>.bvh and takes the nodes and primIndices straight from the mapping. A missing, stale or damaged
+// file is a miss and returns false without a message, the caller builds and stores the tree.
+bool LoadCachedBvh(const fs::path& directory, uint64_t key, uint32_t triangleCount, Bvh& bvh, float& buildSahCost);
+
+// Writes the tree to a temporary file and renames it into place, concurrent writers of the same key leave one complete file
+bool StoreCachedBvh(const fs::path& directory, uint64_t key, const Bvh& bvh, float buildSahCost);
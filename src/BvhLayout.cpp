@@ -0,0 +1,183 @@
+#include "BvhLayout.h"
+#include "BvhTraversal.h"
+#include "Bvh8Traversal.h"
+
+#include <cstdint>
+#include <iostream>
+
+namespace {
+
+class NodeCache
+{
+public:
+    explicit NodeCache(const NodeCacheModel& model)
+        : m_lineBytes(model.lineBytes), m_ways(model.ways), m_setCount(model.sizeBytes / (model.lineBytes * model.ways)),
+          m_tags(static_cast<size_t>(m_setCount) * m_ways, ~uint64_t{0}), m_stamps(m_tags.size(), 0)
+    {
+    }
+
+    void Touch(const void* address, size_t bytes)
+    {
+        const uint64_t first = reinterpret_cast<uintptr_t>(address) / m_lineBytes;
+        const uint64_t last = (reinterpret_cast<uintptr_t>(address) + bytes - 1) / m_lineBytes;
+        for (uint64_t line = first; line <= last; line++) Access(line);
+    }
+
+    uint64_t Misses() const { return m_misses; }
+
+private:
+    void Access(uint64_t line)
+    {
+        const size_t set = static_cast<size_t>(line % m_setCount) * m_ways;
+        size_t victim = set;
+        m_clock++;
+        for (size_t way = set; way < set + m_ways; way++)
+        {
+            if (m_tags[way] == line)
+            {
+                m_stamps[way] = m_clock;
+                return;
+            }
+            if (m_stamps[way] < m_stamps[victim])
+                victim = way;
+        }
+        m_tags[victim] = line;
+        m_stamps[victim] = m_clock;
+        m_misses++;
+    }
+
+    uint32_t m_lineBytes;
+    uint32_t m_ways;
+    uint32_t m_setCount;
+    std::vector<uint64_t> m_tags;
+    std::vector<uint64_t> m_stamps;
+    uint64_t m_clock{0};
+    uint64_t m_misses{0};
+};
+
+// Stands in for a layout in the traversal templates, every node fetch goes through the cache first
+template<typename Node>
+struct ProbedNodes
+{
+    const std::vector<Node>& nodes;
+    NodeCache& cache;
+
+    bool empty() const { return nodes.empty(); }
+
+    const Node& operator[](size_t index) const
+    {
+        cache.Touch(&nodes[index], sizeof(Node));
+        return nodes[index];
+    }
+};
+
+template<typename Layout>
+struct ProbedLayout
+{
+    ProbedNodes<typename decltype(Layout::nodes)::value_type> nodes;
+    const std::vector<uint32_t>& primIndices;
+
+    ProbedLayout(const Layout& layout, NodeCache& cache) : nodes{layout.nodes, cache}, primIndices(layout.primIndices) {}
+};
+
+} // namespace
+
+bool ReorderBvhDepthFirst(Bvh& bvh)
+{
+    if (bvh.nodes.empty())
+    {
+        std::cerr << "Bvh reorder: empty bvh\n";
+        return false;
+    }
+
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primIndices;
+    nodes.reserve(bvh.nodes.size());
+    primIndices.reserve(bvh.primIndices.size());
+
+    // a node is placed together with its sibling, the traversal reads the boxes of both children at every step
+    nodes.push_back(bvh.nodes[0]);
+    std::vector<uint32_t> stack{0};
+    while (!stack.empty())
+    {
+        const uint32_t index = stack.back();
+        stack.pop_back();
+
+        BvhNode& node = nodes[index];
+        if (node.IsLeaf())
+        {
+            const uint32_t primOffset = static_cast<uint32_t>(primIndices.size());
+            primIndices.insert(primIndices.end(), bvh.primIndices.begin() + node.primOffset, bvh.primIndices.begin() + node.primOffset + node.primCount);
+            node.primOffset = primOffset;
+            continue;
+        }
+
+        // the larger child becomes child[0] and its subtree follows right after the pair
+        const bool swap = bvh.nodes[node.child[1]].box.area() > bvh.nodes[node.child[0]].box.area();
+        const uint32_t larger = swap ? node.child[1] : node.child[0];
+        const uint32_t smaller = swap ? node.child[0] : node.child[1];
+        const uint32_t first = static_cast<uint32_t>(nodes.size());
+        node.child[0] = first;
+        node.child[1] = first + 1;
+        nodes.push_back(bvh.nodes[larger]);
+        nodes.push_back(bvh.nodes[smaller]);
+        nodes[first].parent = index;
+        nodes[first + 1].parent = index;
+
+        stack.push_back(first + 1);
+        stack.push_back(first);
+    }
+
+    bvh.nodes.swap(nodes);
+    bvh.primIndices.swap(primIndices);
+    return true;
+}
+
+bool MeasureNodeCacheMisses(const HostScene& scene, const std::vector<hiprtRay>& rays, const NodeCacheModel& model, float& missesPerRay)
+{
+    missesPerRay = 0.0f;
+    if (!scene.instances.empty())
+    {
+        std::cerr << "Node cache measurement: instanced scenes are not supported\n";
+        return false;
+    }
+    if (model.lineBytes == 0 || model.ways == 0 || model.sizeBytes < model.lineBytes * model.ways)
+    {
+        std::cerr << "Node cache measurement: invalid cache model\n";
+        return false;
+    }
+    if (rays.empty())
+        return true;
+
+    NodeCache cache(model);
+    for (const hiprtRay& ray : rays)
+    {
+        float closest = ray.maxT;
+        for (const HostGeometry& geometry : scene.geometries)
+        {
+            auto leafFunc = [&](uint32_t primIndex, float& maxT) {
+                hiprtHit hit;
+                if (geometry.spheres != nullptr)
+                {
+                    if (intersectSphere(ray, geometry.spheres[primIndex], maxT, hit))
+                        maxT = hit.t;
+                    return false;
+                }
+                const uint3& t = geometry.indices[primIndex];
+                if (IntersectTriangle(ray, geometry.vertices[t.x], geometry.vertices[t.y], geometry.vertices[t.z], maxT, hit))
+                    maxT = hit.t;
+                return false;
+            };
+
+            if (!geometry.compressedBvh8.nodes.empty())
+                TraverseBvh8(ProbedLayout<CompressedBvh8>(geometry.compressedBvh8, cache), ray, closest, leafFunc);
+            else if (!geometry.bvh8.nodes.empty())
+                TraverseBvh8(ProbedLayout<Bvh8>(geometry.bvh8, cache), ray, closest, leafFunc);
+            else
+                TraverseBvh(ProbedLayout<Bvh>(geometry.bvh, cache), ray, closest, leafFunc);
+        }
+    }
+
+    missesPerRay = static_cast<float>(static_cast<double>(cache.Misses()) / rays.size());
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+#include "HostScene.h"
+
+#include <vector>
+
+// Stores the nodes depth first in sibling pairs, both child boxes of a node share a cache line or two. The child of
+// larger surface area, the one a ray is most likely to enter, becomes child[0] and its subtree follows right after the
+// pair. The primIndices of the leaves are moved into the same order, so the primitives of neighbouring leaves are
+// neighbours in memory as well. Node indices, child and parent links and leaf offsets are rewritten, the tree itself
+// does not change.
+bool ReorderBvhDepthFirst(Bvh& bvh);
+
+// Set associative LRU cache that the node fetches of a traversal are replayed against, the defaults are a typical L1
+struct NodeCacheModel
+{
+    uint32_t sizeBytes{32 * 1024};
+    uint32_t lineBytes{64};
+    uint32_t ways{8};
+};
+
+// Traces the rays one after another through the traversed layout of every geometry of a flat scene (closest hit) and
+// counts the cache lines of node fetches that miss the modelled cache. Only nodes are counted, triangle data is not.
+// The cache state carries over from ray to ray, so the order of the rays matters as it does in the renderer.
+bool MeasureNodeCacheMisses(const HostScene& scene, const std::vector<hiprtRay>& rays, const NodeCacheModel& model, float& missesPerRay);
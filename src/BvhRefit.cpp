@@ -0,0 +1,59 @@
+#include "Bvh.h"
+#include "Parallel.h"
+
+#include <atomic>
+#include <iostream>
+
+namespace {
+
+constexpr uint32_t ChunkSize = 4096;
+
+} // namespace
+
+bool RefitBvh(const std::vector<hiprt::Aabb>& primBoxes, Bvh& bvh)
+{
+    if (bvh.nodes.empty())
+    {
+        std::cerr << "Bvh refit: empty bvh\n";
+        return false;
+    }
+
+    const uint32_t nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+    const uint32_t chunkCount = (nodeCount + ChunkSize - 1) / ChunkSize;
+
+    // every leaf walks up to the root, the second one to reach an inner node merges both children and goes on
+    std::vector<std::atomic<uint32_t>> visits(nodeCount);
+    for (auto& v : visits) v.store(0, std::memory_order_relaxed);
+
+    ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min(nodeCount, (chunk + 1) * ChunkSize);
+        for (uint32_t i = chunk * ChunkSize; i < end; i++)
+        {
+            BvhNode& leaf = bvh.nodes[i];
+            if (!leaf.IsLeaf())
+                continue;
+
+            leaf.box.reset();
+            for (uint32_t k = 0; k < leaf.primCount; k++) leaf.box.grow(primBoxes[bvh.primIndices[leaf.primOffset + k]]);
+
+            uint32_t node = leaf.parent;
+            while (node != InvalidNodeIndex)
+            {
+                if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+                    break;
+                BvhNode& inner = bvh.nodes[node];
+                inner.box = hiprt::Aabb(bvh.nodes[inner.child[0]].box, bvh.nodes[inner.child[1]].box);
+                node = inner.parent;
+            }
+        }
+    });
+
+    return true;
+}
+
+float ComputeRefitDegradation(const Bvh& bvh, float buildSahCost, const BvhBuildOptions& options)
+{
+    if (buildSahCost <= 0.0f)
+        return 1.0f;
+    return ComputeSahCost(bvh, options) / buildSahCost;
+}
@@ -0,0 +1,82 @@
+#include "BvhStats.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// std::min and std::max on purpose, the fminf of hiprt::min is a libm call without fast math
+float OverlapArea(const hiprt::Aabb& a, const hiprt::Aabb& b)
+{
+    const float3 lo = make_float3(std::max(a.m_min.x, b.m_min.x), std::max(a.m_min.y, b.m_min.y), std::max(a.m_min.z, b.m_min.z));
+    const float3 hi = make_float3(std::min(a.m_max.x, b.m_max.x), std::min(a.m_max.y, b.m_max.y), std::min(a.m_max.z, b.m_max.z));
+    if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z)
+        return 0.0f;
+    return hiprt::Aabb(lo, hi).area();
+}
+
+} // namespace
+
+bool ComputeBvhStats(const Bvh& bvh, const BvhBuildOptions& options, BvhStats& stats)
+{
+    stats = BvhStats{};
+    if (bvh.nodes.empty())
+    {
+        std::cerr << "Bvh stats: empty bvh\n";
+        return false;
+    }
+
+    stats.sahCost = ComputeSahCost(bvh, options);
+    stats.nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+    stats.primReferenceCount = static_cast<uint32_t>(bvh.primIndices.size());
+
+    const float rootArea = bvh.nodes[0].box.area();
+    double overlapSum = 0.0;
+    double sahOverlap = 0.0;
+
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t depth;
+    };
+    std::vector<Entry> stack{{0, 0}};
+    while (!stack.empty())
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.depth >= MaxBvhDepth)
+        {
+            std::cerr << "Bvh stats: tree deeper than MaxBvhDepth\n";
+            return false;
+        }
+
+        const BvhNode& node = bvh.nodes[entry.node];
+        stats.maxDepth = std::max(stats.maxDepth, entry.depth);
+        if (node.IsLeaf())
+        {
+            stats.leafCount++;
+            if (stats.leafDepthHistogram.size() <= entry.depth)
+                stats.leafDepthHistogram.resize(entry.depth + 1, 0);
+            stats.leafDepthHistogram[entry.depth]++;
+            if (stats.leafSizeHistogram.size() <= node.primCount)
+                stats.leafSizeHistogram.resize(node.primCount + 1, 0);
+            stats.leafSizeHistogram[node.primCount]++;
+            continue;
+        }
+
+        stats.innerCount++;
+        const float overlap = OverlapArea(bvh.nodes[node.child[0]].box, bvh.nodes[node.child[1]].box);
+        const float area = node.box.area();
+        if (area > 0.0f)
+            overlapSum += overlap / area;
+        if (rootArea > 0.0f)
+            sahOverlap += overlap / rootArea;
+
+        stack.push_back({node.child[1], entry.depth + 1});
+        stack.push_back({node.child[0], entry.depth + 1});
+    }
+
+    stats.meanChildOverlap = stats.innerCount > 0 ? static_cast<float>(overlapSum / stats.innerCount) : 0.0f;
+    stats.sahOverlap = static_cast<float>(sahOverlap);
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+
+#include <vector>
+
+// Shape of one binary Bvh, the part of the analysis report that needs no rays
+struct BvhStats
+{
+    float sahCost{0.0f};
+    uint32_t nodeCount{0};
+    uint32_t innerCount{0};
+    uint32_t leafCount{0};
+    // longer than the primitive count when a builder duplicates references (spatial splits)
+    uint32_t primReferenceCount{0};
+    uint32_t maxDepth{0};
+    // leaves per depth, the root is at depth 0
+    std::vector<uint32_t> leafDepthHistogram;
+    // leaves per primitive count, index 0 stays 0
+    std::vector<uint32_t> leafSizeHistogram;
+    // mean over the inner nodes of the overlap of the two child boxes relative to the parent area
+    float meanChildOverlap{0.0f};
+    // sum over the inner nodes of the child overlap area relative to the root area. With the SAH argument this is the
+    // expected number of node visits a random ray pays for entering both children where one would do.
+    float sahOverlap{0.0f};
+};
+
+bool ComputeBvhStats(const Bvh& bvh, const BvhBuildOptions& options, BvhStats& stats);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Bvh.h"
+
+// Entry and exit distance of the ray into one node. Views with other node bounds (ObbBvhView) overload it.
+template<typename BinaryBvh>
+float2 IntersectBvhNode(const BinaryBvh& bvh, uint32_t index, const hiprtRay&, const float3& invD, const float3& oxInvD, float maxT)
+{
+    return bvh.nodes[index].box.intersect(invD, oxInvD, maxT);
+}
+
+// Stack based traversal of a binary Bvh, nearer child first.
+// leafFunc(primOffset, primCount, maxT) tests the primitives bvh.primIndices[primOffset, primOffset + primCount) of one
+// leaf, shrinks maxT on a closer hit and returns true to stop the traversal. rootIndex starts the traversal in a subtree.
+// BinaryBvh is a Bvh or a view with the same nodes member (the cache probe of MeasureNodeCacheMisses, ObbBvhView).
+template<typename BinaryBvh, typename LeafFunc>
+void TraverseBvhLeaves(const BinaryBvh& bvh, const hiprtRay& ray, float& maxT, LeafFunc&& leafFunc, uint32_t rootIndex = 0)
+{
+    if (bvh.nodes.empty())
+        return;
+
+    const float3 invD = hiprt::safeInv(ray.direction);
+    const float3 oxInvD = -ray.origin * invD;
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float t;
+    };
+    StackEntry stack[MaxBvhDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = rootIndex;
+
+    float2 rootT = IntersectBvhNode(bvh, rootIndex, ray, invD, oxInvD, maxT);
+    if (rootT.x > rootT.y)
+        return;
+
+    while (true)
+    {
+        const BvhNode& node = bvh.nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            if (leafFunc(node.primOffset, node.primCount, maxT))
+                return;
+        }
+        else
+        {
+            float2 t0 = IntersectBvhNode(bvh, node.child[0], ray, invD, oxInvD, maxT);
+            float2 t1 = IntersectBvhNode(bvh, node.child[1], ray, invD, oxInvD, maxT);
+            bool hit0 = t0.x <= t0.y;
+            bool hit1 = t1.x <= t1.y;
+            if (hit0 && hit1)
+            {
+                uint32_t nearChild = t0.x <= t1.x ? node.child[0] : node.child[1];
+                uint32_t farChild = t0.x <= t1.x ? node.child[1] : node.child[0];
+                stack[stackSize++] = {farChild, fmaxf(t0.x, t1.x)};
+                nodeIndex = nearChild;
+                continue;
+            }
+            if (hit0 || hit1)
+            {
+                nodeIndex = hit0 ? node.child[0] : node.child[1];
+                continue;
+            }
+        }
+
+        // skip entries that a closer hit has moved out of range
+        do
+        {
+            if (stackSize == 0)
+                return;
+            --stackSize;
+        } while (stack[stackSize].t > maxT);
+        nodeIndex = stack[stackSize].node;
+    }
+}
+
+// leafFunc(primIndex, maxT) tests one primitive, same contract otherwise
+template<typename BinaryBvh, typename LeafFunc>
+void TraverseBvh(const BinaryBvh& bvh, const hiprtRay& ray, float& maxT, LeafFunc&& leafFunc)
+{
+    TraverseBvhLeaves(bvh, ray, maxT, [&](uint32_t primOffset, uint32_t primCount, float& leafMaxT) {
+        for (uint32_t i = 0; i < primCount; i++)
+        {
+            if (leafFunc(bvh.primIndices[primOffset + i], leafMaxT))
+                return true;
+        }
+        return false;
+    });
+}
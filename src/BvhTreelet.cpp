@@ -0,0 +1,245 @@
+#include "Bvh.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+// 2^7 leaf subsets keep the exhaustive partition search at 3^7 steps per treelet
+constexpr uint32_t MaxTreeletLeaves = 7;
+constexpr uint32_t TreeletSubsetCount = 1u << MaxTreeletLeaves;
+// a treelet is only rewritten when it gets cheaper by more than this, rounding noise would flip equal topologies
+constexpr float TreeletMinGain = 1.0e-6f;
+
+struct Treelet
+{
+    uint32_t leafCount{0};
+    uint32_t innerCount{0};
+    uint32_t leaves[MaxTreeletLeaves];
+    uint32_t inner[MaxTreeletLeaves - 1];
+};
+
+struct TreeletScratch
+{
+    float area[TreeletSubsetCount];
+    float cost[TreeletSubsetCount];
+    uint32_t height[TreeletSubsetCount];
+    uint8_t split[TreeletSubsetCount];
+};
+
+// std::min and std::max on purpose, the fminf of hiprt::min is a libm call without fast math
+hiprt::Aabb MergeBoxes(const hiprt::Aabb& a, const hiprt::Aabb& b)
+{
+    return hiprt::Aabb(make_float3(std::min(a.m_min.x, b.m_min.x), std::min(a.m_min.y, b.m_min.y), std::min(a.m_min.z, b.m_min.z)),
+                       make_float3(std::max(a.m_max.x, b.m_max.x), std::max(a.m_max.y, b.m_max.y), std::max(a.m_max.z, b.m_max.z)));
+}
+
+// Opens the treelet leaf with the largest surface area until there are MaxTreeletLeaves of them or only Bvh leaves are left
+void FormTreelet(const Bvh& bvh, uint32_t root, Treelet& treelet)
+{
+    treelet.inner[0] = root;
+    treelet.innerCount = 1;
+    treelet.leaves[0] = bvh.nodes[root].child[0];
+    treelet.leaves[1] = bvh.nodes[root].child[1];
+    treelet.leafCount = 2;
+
+    while (treelet.leafCount < MaxTreeletLeaves)
+    {
+        uint32_t best = InvalidNodeIndex;
+        float bestArea = -1.0f;
+        for (uint32_t i = 0; i < treelet.leafCount; i++)
+        {
+            const BvhNode& node = bvh.nodes[treelet.leaves[i]];
+            if (!node.IsLeaf() && node.box.area() > bestArea)
+            {
+                best = i;
+                bestArea = node.box.area();
+            }
+        }
+        if (best == InvalidNodeIndex)
+            break;
+
+        const BvhNode& opened = bvh.nodes[treelet.leaves[best]];
+        treelet.inner[treelet.innerCount++] = treelet.leaves[best];
+        treelet.leaves[best] = opened.child[0];
+        treelet.leaves[treelet.leafCount++] = opened.child[1];
+    }
+}
+
+// Writes the topology chosen for subset under node, reusing the inner nodes of the old treelet from nextInner on
+void EmitTreelet(Bvh& bvh, const Treelet& treelet, const TreeletScratch& scratch, uint32_t subset, uint32_t node, uint32_t& nextInner, std::vector<uint32_t>& heights)
+{
+    const uint32_t left = static_cast<uint32_t>(scratch.split[subset]);
+    const uint32_t parts[2] = {left, subset & ~left};
+    for (uint32_t side = 0; side < 2; side++)
+    {
+        uint32_t child;
+        if ((parts[side] & (parts[side] - 1)) == 0)
+        {
+            child = treelet.leaves[std::countr_zero(parts[side])];
+        }
+        else
+        {
+            child = treelet.inner[nextInner++];
+            EmitTreelet(bvh, treelet, scratch, parts[side], child, nextInner, heights);
+        }
+        bvh.nodes[node].child[side] = child;
+        bvh.nodes[child].parent = node;
+    }
+    bvh.nodes[node].box = MergeBoxes(bvh.nodes[bvh.nodes[node].child[0]].box, bvh.nodes[bvh.nodes[node].child[1]].box);
+    heights[node] = scratch.height[subset];
+}
+
+// Finds the cheapest binary tree over the treelet leaves and rewrites the treelet when it beats the current one and its
+// height, counted down to the deepest Bvh leaf, stays within maxHeight. The subtrees below the treelet leaves and the box
+// of the root stay as they are, so the nodes outside are untouched.
+bool RestructureTreelet(Bvh& bvh, uint32_t root, uint32_t maxHeight, const BvhBuildOptions& options, TreeletScratch& scratch, std::vector<uint32_t>& heights)
+{
+    Treelet treelet;
+    FormTreelet(bvh, root, treelet);
+    if (treelet.leafCount < 3)
+        return false;
+
+    float oldCost = 0.0f;
+    for (uint32_t i = 0; i < treelet.innerCount; i++) oldCost += options.traversalCost * bvh.nodes[treelet.inner[i]].box.area();
+
+    const uint32_t fullSet = (1u << treelet.leafCount) - 1;
+    for (uint32_t subset = 1; subset <= fullSet; subset++)
+    {
+        const uint32_t lowest = subset & (0u - subset);
+        if (subset == lowest)
+        {
+            scratch.area[subset] = bvh.nodes[treelet.leaves[std::countr_zero(subset)]].box.area();
+            scratch.cost[subset] = 0.0f;
+            scratch.height[subset] = heights[treelet.leaves[std::countr_zero(subset)]];
+            continue;
+        }
+
+        const BvhNode& first = bvh.nodes[treelet.leaves[std::countr_zero(subset)]];
+        hiprt::Aabb box = first.box;
+        for (uint32_t rest = subset & (subset - 1); rest != 0; rest &= rest - 1) box = MergeBoxes(box, bvh.nodes[treelet.leaves[std::countr_zero(rest)]].box);
+        scratch.area[subset] = box.area();
+
+        // the costs of the subtrees below the treelet leaves are the same for every topology and left out, ties go to the
+        // shallower split so coincident boxes do not grow chains
+        float bestCost = std::numeric_limits<float>::max();
+        uint32_t bestHeight = std::numeric_limits<uint32_t>::max();
+        uint32_t bestSplit = lowest;
+        for (uint32_t part = (subset - 1) & subset; part != 0; part = (part - 1) & subset)
+        {
+            if ((part & lowest) == 0)
+                continue;
+            const float cost = scratch.cost[part] + scratch.cost[subset & ~part];
+            const uint32_t height = std::max(scratch.height[part], scratch.height[subset & ~part]) + 1;
+            if (cost < bestCost || (cost == bestCost && height < bestHeight))
+            {
+                bestCost = cost;
+                bestHeight = height;
+                bestSplit = part;
+            }
+        }
+        scratch.cost[subset] = options.traversalCost * scratch.area[subset] + bestCost;
+        scratch.height[subset] = bestHeight;
+        scratch.split[subset] = static_cast<uint8_t>(bestSplit);
+    }
+
+    if (scratch.cost[fullSet] >= oldCost * (1.0f - TreeletMinGain) || scratch.height[fullSet] > maxHeight)
+        return false;
+
+    uint32_t nextInner = 1;
+    EmitTreelet(bvh, treelet, scratch, fullSet, root, nextInner, heights);
+    return true;
+}
+
+} // namespace
+
+bool OptimizeBvhTreelets(Bvh& bvh, const BvhBuildOptions& options, float* sahBefore, float* sahAfter)
+{
+    if (bvh.nodes.empty())
+    {
+        std::cerr << "Bvh treelets: empty bvh\n";
+        return false;
+    }
+
+    if (sahBefore != nullptr)
+        *sahBefore = ComputeSahCost(bvh, options);
+
+    const uint32_t nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+    const uint32_t workerCount = GetWorkerCount();
+    std::vector<TreeletScratch> scratch(workerCount);
+    std::vector<uint32_t> leafCounts(nodeCount);
+    // edges down to the deepest Bvh leaf, kept current as the levels below are rewritten
+    std::vector<uint32_t> heights(nodeCount);
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> levelBegin;
+    order.reserve(nodeCount);
+
+    for (uint32_t round = 0; round < options.treeletRounds; round++)
+    {
+        // breadth first order of the current topology, a level holds disjoint subtrees
+        order.clear();
+        levelBegin.clear();
+        order.push_back(0);
+        for (uint32_t begin = 0; begin < order.size();)
+        {
+            levelBegin.push_back(begin);
+            const uint32_t end = static_cast<uint32_t>(order.size());
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const BvhNode& node = bvh.nodes[order[i]];
+                if (!node.IsLeaf())
+                {
+                    order.push_back(node.child[0]);
+                    order.push_back(node.child[1]);
+                }
+            }
+            begin = end;
+        }
+        levelBegin.push_back(static_cast<uint32_t>(order.size()));
+
+        for (uint32_t i = static_cast<uint32_t>(order.size()); i-- > 0;)
+        {
+            const BvhNode& node = bvh.nodes[order[i]];
+            leafCounts[order[i]] = node.IsLeaf() ? 1 : leafCounts[node.child[0]] + leafCounts[node.child[1]];
+            heights[order[i]] = node.IsLeaf() ? 0 : std::max(heights[node.child[0]], heights[node.child[1]]) + 1;
+        }
+
+        // bottom-up one level at a time, the treelets rooted on one level never share nodes. Only subtrees with enough
+        // leaves for a full treelet are restructured, that leaves out most of the nodes at little loss. A node keeps its
+        // level while the levels below are rewritten, so a treelet rooted on level may reach MaxBvhDepth - 1 - level down.
+        std::atomic<uint32_t> changed{0};
+        for (uint32_t level = static_cast<uint32_t>(levelBegin.size()) - 1; level-- > 0;)
+        {
+            const uint32_t begin = levelBegin[level];
+            const uint32_t count = levelBegin[level + 1] - begin;
+            ParallelFor(
+                count,
+                [&](uint32_t item, uint32_t worker) {
+                    const uint32_t root = order[begin + item];
+                    const BvhNode& node = bvh.nodes[root];
+                    if (!node.IsLeaf())
+                        heights[root] = std::max(heights[node.child[0]], heights[node.child[1]]) + 1;
+                    const uint32_t maxHeight = level < MaxBvhDepth ? MaxBvhDepth - 1 - level : 0;
+                    if (leafCounts[root] >= MaxTreeletLeaves && RestructureTreelet(bvh, root, maxHeight, options, scratch[worker], heights))
+                        changed.fetch_add(1, std::memory_order_relaxed);
+                },
+                workerCount);
+        }
+
+        if (heights[0] >= MaxBvhDepth)
+        {
+            std::cerr << "Bvh treelets: tree deeper than MaxBvhDepth\n";
+            return false;
+        }
+        if (changed.load() == 0)
+            break;
+    }
+
+    if (sahAfter != nullptr)
+        *sahAfter = ComputeSahCost(bvh, options);
+    return true;
+}
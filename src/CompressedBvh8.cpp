@@ -0,0 +1,127 @@
+#include "CompressedBvh8.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+constexpr int32_t MinExponent = -126;
+constexpr int32_t MaxExponent = 127;
+
+// smallest power of two step that covers [lo, hi] with 255 steps from lo, checked with the decode expression
+int8_t FindExponent(float lo, float hi)
+{
+    int32_t exponent = MinExponent;
+    const float extent = hi - lo;
+    if (extent > 0.0f)
+        std::frexp(extent / 255.0f, &exponent);
+
+    exponent = std::max(exponent, MinExponent);
+    while (exponent < MaxExponent && lo + 255.0f * QuantizationScale(static_cast<int8_t>(exponent)) < hi) exponent++;
+    return static_cast<int8_t>(exponent);
+}
+
+// round lower planes down and upper planes up so the decoded box contains the original one
+uint8_t QuantizeMin(float value, float origin, float scale)
+{
+    float q = std::floor((value - origin) / scale);
+    q = std::min(std::max(q, 0.0f), 255.0f);
+    while (q > 0.0f && origin + q * scale > value) q -= 1.0f;
+    return static_cast<uint8_t>(q);
+}
+
+uint8_t QuantizeMax(float value, float origin, float scale)
+{
+    float q = std::ceil((value - origin) / scale);
+    q = std::min(std::max(q, 0.0f), 255.0f);
+    while (q < 255.0f && origin + q * scale < value) q += 1.0f;
+    return static_cast<uint8_t>(q);
+}
+
+} // namespace
+
+bool CompressBvh8(const Bvh8& bvh8, CompressedBvh8& compressed, std::vector<uint32_t>* compressedNodes)
+{
+    compressed.nodes.clear();
+    compressed.primIndices.clear();
+
+    if (bvh8.nodes.empty())
+    {
+        std::cerr << "Bvh8 compression: empty bvh\n";
+        return false;
+    }
+
+    compressed.nodes.reserve(bvh8.nodes.size());
+    compressed.primIndices.reserve(bvh8.primIndices.size());
+    compressed.nodes.emplace_back();
+
+    // nodes are emitted breadth first so the inner children of every node end up next to each other
+    std::vector<uint32_t> sourceNodes{0};
+    for (uint32_t index = 0; index < sourceNodes.size(); index++)
+    {
+        const Bvh8Node& source = bvh8.nodes[sourceNodes[index]];
+        CompressedBvh8Node node{};
+
+        const uint32_t childCount = source.childCount;
+        float3 boxMin = make_float3(std::numeric_limits<float>::max());
+        float3 boxMax = make_float3(-std::numeric_limits<float>::max());
+        for (uint32_t i = 0; i < childCount; i++)
+        {
+            boxMin = hiprt::min(boxMin, make_float3(source.minX[i], source.minY[i], source.minZ[i]));
+            boxMax = hiprt::max(boxMax, make_float3(source.maxX[i], source.maxY[i], source.maxZ[i]));
+        }
+
+        node.origin = boxMin;
+        node.exponent[0] = FindExponent(boxMin.x, boxMax.x);
+        node.exponent[1] = FindExponent(boxMin.y, boxMax.y);
+        node.exponent[2] = FindExponent(boxMin.z, boxMax.z);
+        node.childCount = static_cast<uint8_t>(childCount);
+        node.nodeBase = static_cast<uint32_t>(sourceNodes.size());
+        node.primBase = static_cast<uint32_t>(compressed.primIndices.size());
+
+        const float scaleX = QuantizationScale(node.exponent[0]);
+        const float scaleY = QuantizationScale(node.exponent[1]);
+        const float scaleZ = QuantizationScale(node.exponent[2]);
+
+        uint32_t innerCount = 0;
+        uint32_t primCount = 0;
+        for (uint32_t i = 0; i < childCount; i++)
+        {
+            node.qMinX[i] = QuantizeMin(source.minX[i], boxMin.x, scaleX);
+            node.qMinY[i] = QuantizeMin(source.minY[i], boxMin.y, scaleY);
+            node.qMinZ[i] = QuantizeMin(source.minZ[i], boxMin.z, scaleZ);
+            node.qMaxX[i] = QuantizeMax(source.maxX[i], boxMin.x, scaleX);
+            node.qMaxY[i] = QuantizeMax(source.maxY[i], boxMin.y, scaleY);
+            node.qMaxZ[i] = QuantizeMax(source.maxZ[i], boxMin.z, scaleZ);
+
+            if (source.primCount[i] == 0)
+            {
+                node.childOffset[i] = static_cast<uint8_t>(innerCount++);
+                sourceNodes.push_back(source.child[i]);
+                compressed.nodes.emplace_back();
+                continue;
+            }
+
+            if (primCount + source.primCount[i] > 255)
+            {
+                std::cerr << "Bvh8 compression: too many primitives in the leaves of a node\n";
+                return false;
+            }
+            node.childOffset[i] = static_cast<uint8_t>(primCount);
+            node.primCount[i] = static_cast<uint8_t>(source.primCount[i]);
+            primCount += source.primCount[i];
+            for (uint32_t k = 0; k < source.primCount[i]; k++) compressed.primIndices.push_back(bvh8.primIndices[source.child[i] + k]);
+        }
+        compressed.nodes[index] = node;
+    }
+
+    if (compressedNodes)
+    {
+        compressedNodes->assign(bvh8.nodes.size(), 0);
+        for (uint32_t index = 0; index < sourceNodes.size(); index++) (*compressedNodes)[sourceNodes[index]] = index;
+    }
+
+    return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh8.h"
+
+#include <bit>
+#include <vector>
+
+// Bvh8 node with the child boxes quantized to 8 bits inside the node box: child plane = origin + q * 2^exponent.
+// Lower planes are rounded down and upper planes up, a decoded box always contains the original one.
+// Inner children of a node are stored consecutively from nodeBase and the primitives of its leaves from primBase,
+// childOffset is relative to the one that matches the slot type. 88 bytes against 288 for a Bvh8Node.
+struct alignas(8) CompressedBvh8Node
+{
+    float3 origin;
+    int8_t exponent[3];
+    uint8_t childCount;
+    uint32_t nodeBase;
+    uint32_t primBase;
+    uint8_t childOffset[Bvh8Width];
+    uint8_t primCount[Bvh8Width];
+    uint8_t qMinX[Bvh8Width];
+    uint8_t qMinY[Bvh8Width];
+    uint8_t qMinZ[Bvh8Width];
+    uint8_t qMaxX[Bvh8Width];
+    uint8_t qMaxY[Bvh8Width];
+    uint8_t qMaxZ[Bvh8Width];
+};
+
+struct CompressedBvh8
+{
+    std::vector<CompressedBvh8Node> nodes;
+    std::vector<uint32_t> primIndices;
+};
+
+inline uint32_t ChildIndex(const CompressedBvh8Node& node, uint32_t slot)
+{
+    return (node.primCount[slot] > 0 ? node.primBase : node.nodeBase) + node.childOffset[slot];
+}
+
+inline uint32_t ChildPrimCount(const CompressedBvh8Node& node, uint32_t slot)
+{
+    return node.primCount[slot];
+}
+
+// 2^exponent, the encoder keeps exponents in the normal float range
+inline float QuantizationScale(int8_t exponent)
+{
+    return std::bit_cast<float>(static_cast<uint32_t>(exponent + 127) << 23);
+}
+
+// Fails when the leaves of a node reference more than 255 primitives together (maxLeafSize above 31).
+// compressedNodes, when given, receives the index of the compressed node of every Bvh8 node.
+bool CompressBvh8(const Bvh8& bvh8, CompressedBvh8& compressed, std::vector<uint32_t>* compressedNodes = nullptr);
+
+// Decodes the child boxes and runs the slab test on all of them, same result layout as the Bvh8Node version
+inline uint32_t IntersectChildren(const CompressedBvh8Node& node, const Bvh8Ray& ray, float maxT, float* tNear)
+{
+    const float scaleX = QuantizationScale(node.exponent[0]);
+    const float scaleY = QuantizationScale(node.exponent[1]);
+    const float scaleZ = QuantizationScale(node.exponent[2]);
+
+#if defined(__AVX2__)
+    // decode the planes exactly like the encoder checked them (q * scale is exact), then the usual slab test
+    auto slab = [](const uint8_t* q, __m256 scale, __m256 origin, __m256 invD, __m256 oxInvD) {
+        const __m256 qf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q))));
+#    if defined(__FMA__) || defined(_MSC_VER)
+        return _mm256_fmadd_ps(_mm256_fmadd_ps(qf, scale, origin), invD, oxInvD);
+#    else
+        return _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(qf, scale), origin), invD), oxInvD);
+#    endif
+    };
+
+    const __m256 scaleX8 = _mm256_set1_ps(scaleX);
+    const __m256 scaleY8 = _mm256_set1_ps(scaleY);
+    const __m256 scaleZ8 = _mm256_set1_ps(scaleZ);
+    const __m256 originX = _mm256_set1_ps(node.origin.x);
+    const __m256 originY = _mm256_set1_ps(node.origin.y);
+    const __m256 originZ = _mm256_set1_ps(node.origin.z);
+    const __m256 invDx = _mm256_set1_ps(ray.invD.x);
+    const __m256 invDy = _mm256_set1_ps(ray.invD.y);
+    const __m256 invDz = _mm256_set1_ps(ray.invD.z);
+    const __m256 oxInvDx = _mm256_set1_ps(ray.oxInvD.x);
+    const __m256 oxInvDy = _mm256_set1_ps(ray.oxInvD.y);
+    const __m256 oxInvDz = _mm256_set1_ps(ray.oxInvD.z);
+
+    const __m256 x0 = slab(node.qMinX, scaleX8, originX, invDx, oxInvDx);
+    const __m256 x1 = slab(node.qMaxX, scaleX8, originX, invDx, oxInvDx);
+    const __m256 y0 = slab(node.qMinY, scaleY8, originY, invDy, oxInvDy);
+    const __m256 y1 = slab(node.qMaxY, scaleY8, originY, invDy, oxInvDy);
+    const __m256 z0 = slab(node.qMinZ, scaleZ8, originZ, invDz, oxInvDz);
+    const __m256 z1 = slab(node.qMaxZ, scaleZ8, originZ, invDz, oxInvDz);
+
+    __m256 t0 = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_max_ps(_mm256_min_ps(z0, z1), _mm256_setzero_ps()));
+    __m256 t1 = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_min_ps(_mm256_max_ps(z0, z1), _mm256_set1_ps(maxT)));
+
+    _mm256_storeu_ps(tNear, t0);
+    const uint32_t hits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)));
+#else
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < node.childCount; i++)
+    {
+        const float3 boxMin = make_float3(node.origin.x + node.qMinX[i] * scaleX, node.origin.y + node.qMinY[i] * scaleY, node.origin.z + node.qMinZ[i] * scaleZ);
+        const float3 boxMax = make_float3(node.origin.x + node.qMaxX[i] * scaleX, node.origin.y + node.qMaxY[i] * scaleY, node.origin.z + node.qMaxZ[i] * scaleZ);
+        float2 t = hiprt::Aabb(boxMin, boxMax).intersect(ray.invD, ray.oxInvD, maxT);
+        tNear[i] = t.x;
+        if (t.x <= t.y)
+            hits |= 1u << i;
+    }
+#endif
+    return hits & ((1u << node.childCount) - 1);
+}
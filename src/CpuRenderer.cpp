@@ -0,0 +1,395 @@
+#include "CpuRenderer.h"
+#include "Parallel.h"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+struct RayCounter
+{
+    uint64_t primary{0};
+    uint64_t ao{0};
+};
+
+// AO rays of a primary hit start just in front of the surface, Ng is the geometric normal facing the primary ray
+hiprtRay AoRay(const CpuRenderSettings& settings, const hiprtRay& ray, const hiprtHit& hit, float3& Ng)
+{
+    // the host traversal already transforms the normal of instanced geometry to world space
+    Ng = hit.normal;
+    if (hiprt::dot(ray.direction, Ng) > 0.0f)
+        Ng = -Ng;
+    Ng = hiprt::normalize(Ng);
+
+    hiprtRay aoRay;
+    aoRay.origin = ray.origin + hit.t * (1.0f - 1.0e-2f) * ray.direction;
+    aoRay.maxT = settings.aoRadius;
+    return aoRay;
+}
+
+// unoccluded AO samples around a primary hit, seed continues the sequence of the primary ray
+float OcclusionSamples(const HostScene& scene, const CpuRenderSettings& settings, const hiprtRay& ray, const hiprtHit& hit, uint32_t& seed, RayCounter& counter)
+{
+    float3 Ng;
+    hiprtRay aoRay = AoRay(settings, ray, hit, Ng);
+
+    // all samples start at the same point, the region of the trees they can reach is found once
+    OcclusionRegion region;
+    if (settings.boundedAo)
+        FindOcclusionRegion(scene, hit, aoRay.origin, aoRay.maxT, region);
+
+    float ao = 0.0f;
+    for (uint32_t i = 0; i < settings.sampling.aoSamples; i++)
+    {
+        aoRay.direction = sampleHemisphereCosine(Ng, seed);
+        ao += !TraceAnyHit(scene, region, aoRay) ? 1.0f : 0.0f;
+    }
+    counter.ao += settings.sampling.aoSamples;
+    return ao;
+}
+
+// Pixels [x0, x1) x [y0, y1) of one tile. Pixel (x, y) has estimates[Index(x, y)] and is sampled while active is set.
+struct SampleTile
+{
+    uint32_t x0;
+    uint32_t y0;
+    uint32_t x1;
+    uint32_t y1;
+    SampleEstimate* estimates;
+    const uint8_t* active;
+
+    uint32_t Width() const { return x1 - x0; }
+    uint32_t PixelCount() const { return (x1 - x0) * (y1 - y0); }
+    uint32_t Index(uint32_t x, uint32_t y) const { return (x - x0) + (y - y0) * (x1 - x0); }
+};
+
+// samples [p0, p1) of one pixel
+void SamplePixel(const HostScene& scene, const Camera& camera, const CpuRenderSettings& settings, uint32_t x, uint32_t y, uint32_t p0, uint32_t p1, SampleEstimate& estimate, RayCounter& counter)
+{
+    const int2 resolution = settings.resolution;
+    for (uint32_t p = p0; p < p1; p++)
+    {
+        uint32_t seed = tea<16>(x + y * resolution.x, p).x;
+
+        hiprtRay ray = generateRay(x, y, resolution, camera, seed, true);
+        hiprtHit hit;
+        counter.primary++;
+        float ao = 0.0f;
+        if (TraceClosest(scene, ray, hit))
+            ao = OcclusionSamples(scene, settings, ray, hit, seed, counter);
+        addSample(estimate, ao);
+    }
+}
+
+// SamplePixel for the active pixels of a block of up to 8x8 pixels of the tile, the primary rays of a sample go as one packet
+void SamplePacket(const HostScene& scene, const Camera& camera, const CpuRenderSettings& settings, const SampleTile& tile, uint32_t bx0, uint32_t by0, uint32_t bx1, uint32_t by1, uint32_t p0, uint32_t p1, RayCounter& counter)
+{
+    const int2 resolution = settings.resolution;
+    const uint32_t width = bx1 - bx0;
+    const uint32_t rayCount = width * (by1 - by0);
+
+    uint64_t activeMask = 0;
+    for (uint32_t i = 0; i < rayCount; i++)
+    {
+        if (tile.active[tile.Index(bx0 + i % width, by0 + i / width)])
+            activeMask |= uint64_t{1} << i;
+    }
+    if (activeMask == 0)
+        return;
+
+    RayPacket packet;
+    hiprtRay rays[RayPacketSize];
+    hiprtHit hits[RayPacketSize];
+    uint32_t seeds[RayPacketSize];
+
+    for (uint32_t p = p0; p < p1; p++)
+    {
+        for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+        {
+            const uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+            const uint32_t x = bx0 + i % width;
+            const uint32_t y = by0 + i / width;
+            seeds[i] = tea<16>(x + y * resolution.x, p).x;
+            rays[i] = generateRay(x, y, resolution, camera, seeds[i], true);
+            SetPacketRay(packet, i, rays[i]);
+        }
+
+        TraceClosestPacket(scene, packet, activeMask, hits);
+        counter.primary += std::popcount(activeMask);
+
+        for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+        {
+            const uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+            const float ao = hits[i].hasHit() ? OcclusionSamples(scene, settings, rays[i], hits[i], seeds[i], counter) : 0.0f;
+            addSample(tile.estimates[tile.Index(bx0 + i % width, by0 + i / width)], ao);
+        }
+    }
+}
+
+// per worker storage of the stream mode, reused from tile to tile
+struct StreamBuffers
+{
+    std::vector<hiprtRay> rays;
+    std::vector<hiprtHit> hits;
+    std::vector<uint32_t> seeds;
+    std::vector<float> ao;
+    RayStream stream;
+    std::vector<uint8_t> occluded;
+};
+
+// SamplePixel for the active pixels of a tile. The primary hits of one sample are found for the whole tile first, then
+// the AO rays of all of them are gathered into one stream, sorted and traced together.
+void SampleStream(const HostScene& scene, const Camera& camera, const CpuRenderSettings& settings, const SampleTile& tile, uint32_t p0, uint32_t p1, StreamBuffers& buffers, RayCounter& counter)
+{
+    const int2 resolution = settings.resolution;
+    const uint32_t width = tile.Width();
+    const uint32_t pixelCount = tile.PixelCount();
+
+    buffers.rays.resize(pixelCount);
+    buffers.hits.resize(pixelCount);
+    buffers.seeds.resize(pixelCount);
+
+    RayPacket packet;
+    for (uint32_t p = p0; p < p1; p++)
+    {
+        uint32_t activeCount = 0;
+        for (uint32_t i = 0; i < pixelCount; i++)
+        {
+            buffers.hits[i] = hiprtHit{};
+            if (!tile.active[i])
+                continue;
+            const uint32_t x = tile.x0 + i % width;
+            const uint32_t y = tile.y0 + i / width;
+            buffers.seeds[i] = tea<16>(x + y * resolution.x, p).x;
+            buffers.rays[i] = generateRay(x, y, resolution, camera, buffers.seeds[i], true);
+            activeCount++;
+        }
+        counter.primary += activeCount;
+
+        if (settings.rayPackets)
+        {
+            for (uint32_t by = tile.y0; by < tile.y1; by += RayPacketWidth)
+            {
+                for (uint32_t bx = tile.x0; bx < tile.x1; bx += RayPacketWidth)
+                {
+                    const uint32_t bx1 = std::min(bx + RayPacketWidth, tile.x1);
+                    const uint32_t by1 = std::min(by + RayPacketWidth, tile.y1);
+                    uint32_t pixels[RayPacketSize];
+                    hiprtHit hits[RayPacketSize];
+                    uint32_t rayCount = 0;
+                    for (uint32_t y = by; y < by1; y++)
+                    {
+                        for (uint32_t x = bx; x < bx1; x++)
+                        {
+                            if (!tile.active[tile.Index(x, y)])
+                                continue;
+                            pixels[rayCount] = tile.Index(x, y);
+                            SetPacketRay(packet, rayCount, buffers.rays[pixels[rayCount]]);
+                            rayCount++;
+                        }
+                    }
+                    if (rayCount == 0)
+                        continue;
+                    TraceClosestPacket(scene, packet, rayCount == RayPacketSize ? ~uint64_t{0} : (uint64_t{1} << rayCount) - 1, hits);
+                    for (uint32_t i = 0; i < rayCount; i++) buffers.hits[pixels[i]] = hits[i];
+                }
+            }
+        }
+        else
+        {
+            for (uint32_t i = 0; i < pixelCount; i++)
+            {
+                if (tile.active[i])
+                    TraceClosest(scene, buffers.rays[i], buffers.hits[i]);
+            }
+        }
+
+        // same seeds and directions as OcclusionSamples, only the order of the traces changes
+        RayStream& stream = buffers.stream;
+        ClearRayStream(stream);
+        for (uint32_t i = 0; i < pixelCount; i++)
+        {
+            if (!buffers.hits[i].hasHit())
+                continue;
+
+            float3 Ng;
+            hiprtRay aoRay = AoRay(settings, buffers.rays[i], buffers.hits[i], Ng);
+            for (uint32_t s = 0; s < settings.sampling.aoSamples; s++)
+            {
+                aoRay.direction = sampleHemisphereCosine(Ng, buffers.seeds[i]);
+                stream.rays.push_back(aoRay);
+                stream.owners.push_back(i);
+            }
+        }
+
+        SortRayStream(stream);
+        buffers.occluded.resize(stream.rays.size());
+        TraceAnyHitStream(scene, stream, buffers.occluded.data());
+        counter.ao += stream.rays.size();
+
+        buffers.ao.assign(pixelCount, 0.0f);
+        for (size_t i = 0; i < stream.rays.size(); i++) buffers.ao[stream.owners[i]] += buffers.occluded[i] ? 0.0f : 1.0f;
+        for (uint32_t i = 0; i < pixelCount; i++)
+        {
+            if (tile.active[i])
+                addSample(tile.estimates[i], buffers.ao[i]);
+        }
+    }
+}
+
+// Samples every pixel of the tile spp times, or in rounds of minSpp while errorThreshold is set: after each round the
+// pixels whose error is small enough drop out and the others go on while the tile has budget left and they are below maxSpp
+void SampleTileAdaptive(const HostScene& scene, const Camera& camera, const CpuRenderSettings& settings, SampleTile tile, std::vector<uint8_t>& active, StreamBuffers* buffers, RayCounter& counter)
+{
+    const AoSampling& sampling = settings.sampling;
+    const uint32_t pixelCount = tile.PixelCount();
+    active.assign(pixelCount, 1);
+    tile.active = active.data();
+
+    auto sampleRound = [&](uint32_t p0, uint32_t p1) {
+        if (buffers != nullptr)
+        {
+            SampleStream(scene, camera, settings, tile, p0, p1, *buffers, counter);
+        }
+        else if (settings.rayPackets)
+        {
+            for (uint32_t by = tile.y0; by < tile.y1; by += RayPacketWidth)
+            {
+                for (uint32_t bx = tile.x0; bx < tile.x1; bx += RayPacketWidth)
+                    SamplePacket(scene, camera, settings, tile, bx, by, std::min(bx + RayPacketWidth, tile.x1), std::min(by + RayPacketWidth, tile.y1), p0, p1, counter);
+            }
+        }
+        else
+        {
+            for (uint32_t y = tile.y0; y < tile.y1; y++)
+            {
+                for (uint32_t x = tile.x0; x < tile.x1; x++)
+                {
+                    if (active[tile.Index(x, y)])
+                        SamplePixel(scene, camera, settings, x, y, p0, p1, tile.estimates[tile.Index(x, y)], counter);
+                }
+            }
+        }
+    };
+
+    if (sampling.errorThreshold <= 0.0f)
+    {
+        sampleRound(0, sampling.spp);
+        return;
+    }
+
+    // the active pixels always share the sample count, they have been in every round so far
+    const uint32_t batch = std::max(sampling.minSpp, 1u);
+    const uint32_t maxSpp = std::max(sampling.maxSpp, batch);
+    const uint64_t budget = static_cast<uint64_t>(sampling.spp) * pixelCount;
+    uint64_t spent = 0;
+    uint32_t activeCount = pixelCount;
+    uint32_t sampleCount = 0;
+    while (activeCount > 0 && sampleCount < maxSpp && spent < budget)
+    {
+        // a round never runs past the budget, spp below minSpp samples every pixel spp times
+        const uint64_t left = (budget - spent) / activeCount;
+        if (left == 0)
+            break;
+        const uint32_t next = std::min(sampleCount + static_cast<uint32_t>(std::min<uint64_t>(batch, left)), maxSpp);
+        sampleRound(sampleCount, next);
+        spent += static_cast<uint64_t>(next - sampleCount) * activeCount;
+        sampleCount = next;
+
+        activeCount = 0;
+        for (uint32_t i = 0; i < pixelCount; i++)
+        {
+            if (active[i] && isConverged(tile.estimates[i], sampling.errorThreshold, sampling.aoSamples))
+                active[i] = 0;
+            activeCount += active[i];
+        }
+    }
+}
+
+} // namespace
+
+bool RenderAoCpu(const HostScene& scene, const Camera& camera, const CpuRenderSettings& settings, std::vector<uint8_t>& image, CpuRenderStats& stats)
+{
+    const int2 resolution = settings.resolution;
+    if (resolution.x <= 0 || resolution.y <= 0 || settings.tileSize == 0)
+    {
+        std::cerr << "Invalid cpu render settings\n";
+        return false;
+    }
+
+    image.assign(resolution.x * resolution.y * 4, 0);
+
+    const uint32_t tilesX = (resolution.x + settings.tileSize - 1) / settings.tileSize;
+    const uint32_t tilesY = (resolution.y + settings.tileSize - 1) / settings.tileSize;
+
+    std::atomic<uint64_t> primaryRays{0};
+    std::atomic<uint64_t> aoRays{0};
+    std::atomic<uint64_t> convergedPixels{0};
+    std::atomic<uint64_t> extendedPixels{0};
+
+    const float3 diffuseColor = make_float3(1.0f);
+
+    const uint32_t workerCount = settings.workerCount > 0 ? settings.workerCount : GetWorkerCount();
+    std::vector<StreamBuffers> streamBuffers(settings.aoStreams ? workerCount : 0);
+    std::vector<std::vector<SampleEstimate>> estimates(workerCount);
+    std::vector<std::vector<uint8_t>> active(workerCount);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    ParallelFor(
+        tilesX * tilesY,
+        [&](uint32_t tileIndex, uint32_t worker) {
+            SampleTile tile;
+            tile.x0 = (tileIndex % tilesX) * settings.tileSize;
+            tile.y0 = (tileIndex / tilesX) * settings.tileSize;
+            tile.x1 = std::min<uint32_t>(tile.x0 + settings.tileSize, resolution.x);
+            tile.y1 = std::min<uint32_t>(tile.y0 + settings.tileSize, resolution.y);
+            estimates[worker].assign(tile.PixelCount(), SampleEstimate{});
+            tile.estimates = estimates[worker].data();
+
+            RayCounter counter;
+            SampleTileAdaptive(scene, camera, settings, tile, active[worker], settings.aoStreams ? &streamBuffers[worker] : nullptr, counter);
+
+            uint64_t converged = 0;
+            uint64_t extended = 0;
+            for (uint32_t y = tile.y0; y < tile.y1; y++)
+            {
+                for (uint32_t x = tile.x0; x < tile.x1; x++)
+                {
+                    const SampleEstimate& estimate = tile.estimates[tile.Index(x, y)];
+                    converged += estimate.count < settings.sampling.spp ? 1 : 0;
+                    extended += estimate.count > settings.sampling.spp ? 1 : 0;
+
+                    const float ao = sampleMean(estimate, settings.sampling.aoSamples);
+                    const uint32_t index = x + y * resolution.x;
+                    image[index * 4 + 0] = static_cast<uint8_t>((ao * diffuseColor.x) * 255);
+                    image[index * 4 + 1] = static_cast<uint8_t>((ao * diffuseColor.y) * 255);
+                    image[index * 4 + 2] = static_cast<uint8_t>((ao * diffuseColor.z) * 255);
+                    image[index * 4 + 3] = 255;
+                }
+            }
+            primaryRays += counter.primary;
+            aoRays += counter.ao;
+            convergedPixels += converged;
+            extendedPixels += extended;
+        },
+        workerCount);
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    stats.primaryRays = primaryRays;
+    stats.aoRays = aoRays;
+    stats.convergedPixels = convergedPixels;
+    stats.extendedPixels = extendedPixels;
+    stats.seconds = std::chrono::duration<double>(end - start).count();
+
+    return true;
+}
+
+void PrintRenderStats(const char* name, const CpuRenderStats& stats)
+{
+    std::cout << name << ": " << stats.seconds << " s, primary rays: " << stats.primaryRays << ", ao rays: " << stats.aoRays << ", " << stats.RaysPerSecond() / 1.0e6
+              << " MRays/s, pixels converged early: " << stats.convergedPixels << ", past spp: " << stats.extendedPixels << "\n";
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "HostScene.h"
+
+#include <vector>
+
+struct CpuRenderSettings
+{
+    int2 resolution{960, 540};
+    // spp, AO rays per sample and the adaptive sampling, same as the kernels. The tiles below are the tiles that share a budget.
+    AoSampling sampling;
+    float aoRadius{1.4f};
+    uint32_t tileSize{16};
+    // primary rays of 8x8 pixel blocks are traced as one RayPacket
+    bool rayPackets{true};
+    // the AO rays of a tile are gathered, sorted by direction octant and origin Morton code and traced in that order.
+    // Off by default, the per pixel order already keeps the rays of one origin together and the sort costs more than it
+    // saves on the room scenes.
+    bool aoStreams{false};
+    // AO rays only traverse the subtrees that can hold triangles within aoRadius of their origin, see OcclusionRegion
+    bool boundedAo{true};
+    uint32_t workerCount{0}; // 0 - use all cores
+};
+
+struct CpuRenderStats
+{
+    uint64_t primaryRays{0};
+    uint64_t aoRays{0};
+    // pixels that stopped before spp samples, and that went past it on what the others left
+    uint64_t convergedPixels{0};
+    uint64_t extendedPixels{0};
+    double seconds{0.0};
+
+    double RaysPerSecond() const { return seconds > 0.0 ? (primaryRays + aoRays) / seconds : 0.0; }
+};
+
+// Host version of AoRayKernel, writes RGBA8 pixels in the same layout as the kernel
+bool RenderAoCpu(const HostScene& scene, const Camera& camera, const CpuRenderSettings& settings, std::vector<uint8_t>& image, CpuRenderStats& stats);
+
+void PrintRenderStats(const char* name, const CpuRenderStats& stats);
@@ -0,0 +1,833 @@
+#include "HostScene.h"
+#include "BvhCache.h"
+#include "BvhLayout.h"
+#include "BvhTraversal.h"
+#include "Bvh8Traversal.h"
+#include "MotionBvhTraversal.h"
+#include "Parallel.h"
+#include "RayPacketTraversal.h"
+#include "SrtFrame.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+
+namespace {
+
+ObbBvhView GeometryObbView(const HostGeometry& geometry)
+{
+    return {geometry.bvh.nodes, geometry.bvh.primIndices, geometry.obbs};
+}
+
+// the wide layouts keep their Aabbs, the oriented root box only culls the rays that miss the whole geometry
+bool MissesRootObb(const HostGeometry& geometry, const hiprtRay& ray, float maxT)
+{
+    if (geometry.obbs.empty() || geometry.obbs.nodeObbs[0] == InvalidNodeIndex)
+        return false;
+    const float2 t = IntersectObb(geometry.obbs.obbs[geometry.obbs.nodeObbs[0]], ray, maxT);
+    return t.x > t.y;
+}
+
+template<typename LeafFunc>
+void TraverseGeometry(const HostGeometry& geometry, const hiprtRay& ray, float& maxT, LeafFunc&& leafFunc)
+{
+    if (!geometry.compressedBvh8.nodes.empty())
+    {
+        if (!MissesRootObb(geometry, ray, maxT))
+            TraverseBvh8(geometry.compressedBvh8, ray, maxT, leafFunc);
+    }
+    else if (!geometry.bvh8.nodes.empty())
+    {
+        if (!MissesRootObb(geometry, ray, maxT))
+            TraverseBvh8(geometry.bvh8, ray, maxT, leafFunc);
+    }
+    else if (!geometry.obbs.empty())
+        TraverseBvh(GeometryObbView(geometry), ray, maxT, leafFunc);
+    else
+        TraverseBvh(geometry.bvh, ray, maxT, leafFunc);
+}
+
+template<typename LeafFunc>
+void TraverseGeometryLeaves(const HostGeometry& geometry, const hiprtRay& ray, float& maxT, LeafFunc&& leafFunc)
+{
+    if (!geometry.compressedBvh8.nodes.empty())
+    {
+        if (!MissesRootObb(geometry, ray, maxT))
+            TraverseBvh8Leaves(geometry.compressedBvh8, ray, maxT, leafFunc);
+    }
+    else if (!geometry.bvh8.nodes.empty())
+    {
+        if (!MissesRootObb(geometry, ray, maxT))
+            TraverseBvh8Leaves(geometry.bvh8, ray, maxT, leafFunc);
+    }
+    else if (!geometry.obbs.empty())
+        TraverseBvhLeaves(GeometryObbView(geometry), ray, maxT, leafFunc);
+    else
+        TraverseBvhLeaves(geometry.bvh, ray, maxT, leafFunc);
+}
+
+// Closest hit in one geometry, or the first one found when anyHit is set. Deformed geometries are interpolated to the
+// ray time when interpolate is set, otherwise the current key frame is traced.
+bool IntersectGeometry(const HostGeometry& geometry, const hiprtRay& ray, float time, bool interpolate, bool anyHit, float& maxT, hiprtHit& hit)
+{
+    bool found = false;
+    if (interpolate && !geometry.motionBvh.bvh.nodes.empty())
+    {
+        const KeyFrameTime keyTime = GetKeyFrameTime(geometry.keyFrameCount, time);
+        const float3* frame0 = geometry.keyFrameVertices + keyTime.frame0 * geometry.vertexCount;
+        const float3* frame1 = geometry.keyFrameVertices + keyTime.frame1 * geometry.vertexCount;
+        auto vertex = [&](uint32_t v) { return frame0[v] + (frame1[v] - frame0[v]) * keyTime.t; };
+
+        TraverseMotionBvh(geometry.motionBvh, ray, time, maxT, [&](uint32_t primIndex, float& leafMaxT) {
+            const uint3& t = geometry.indices[primIndex];
+            hiprtHit candidate;
+            if (!IntersectTriangle(ray, vertex(t.x), vertex(t.y), vertex(t.z), leafMaxT, candidate))
+                return false;
+            hit = candidate;
+            hit.primID = primIndex;
+            leafMaxT = candidate.t;
+            found = true;
+            return anyHit;
+        });
+        return found;
+    }
+
+    if (geometry.spheres != nullptr)
+    {
+        TraverseGeometry(geometry, ray, maxT, [&](uint32_t primIndex, float& leafMaxT) {
+            hiprtHit candidate;
+            if (!intersectSphere(ray, geometry.spheres[primIndex], leafMaxT, candidate))
+                return false;
+            hit = candidate;
+            hit.primID = primIndex;
+            leafMaxT = candidate.t;
+            found = true;
+            return anyHit;
+        });
+        return found;
+    }
+
+    if (!geometry.triangleLeaves.blocks.empty())
+    {
+        TraverseGeometryLeaves(geometry, ray, maxT, [&](uint32_t primOffset, uint32_t primCount, float& leafMaxT) {
+            const Triangle8* blocks = &geometry.triangleLeaves.blocks[geometry.triangleLeaves.leafBlocks[primOffset]];
+            for (uint32_t i = 0; i < primCount; i += Triangle8Width)
+            {
+                hiprtHit candidate;
+                if (!IntersectTriangle8(blocks[i / Triangle8Width], ray, leafMaxT, candidate))
+                    continue;
+                hit = candidate;
+                leafMaxT = candidate.t;
+                found = true;
+                if (anyHit)
+                    return true;
+            }
+            return false;
+        });
+        return found;
+    }
+
+    TraverseGeometry(geometry, ray, maxT, [&](uint32_t primIndex, float& leafMaxT) {
+        const uint3& t = geometry.indices[primIndex];
+        hiprtHit candidate;
+        if (!IntersectTriangle(ray, geometry.vertices[t.x], geometry.vertices[t.y], geometry.vertices[t.z], leafMaxT, candidate))
+            return false;
+        hit = candidate;
+        hit.primID = primIndex;
+        leafMaxT = candidate.t;
+        found = true;
+        return anyHit;
+    });
+    return found;
+}
+
+// Tests the primitives primIndices[primOffset, primOffset + primCount) of one leaf of the traversed layout against ray
+// up to ray.maxT
+bool OccludedLeaf(const HostGeometry& geometry, const std::vector<uint32_t>& primIndices, uint32_t primOffset, uint32_t primCount, const hiprtRay& ray)
+{
+    if (!geometry.triangleLeaves.blocks.empty())
+    {
+        const Triangle8* blocks = &geometry.triangleLeaves.blocks[geometry.triangleLeaves.leafBlocks[primOffset]];
+        for (uint32_t i = 0; i < primCount; i += Triangle8Width)
+        {
+            if (OccludedTriangle8(blocks[i / Triangle8Width], ray, ray.maxT))
+                return true;
+        }
+        return false;
+    }
+
+    hiprtHit hit;
+    if (geometry.spheres != nullptr)
+    {
+        for (uint32_t i = 0; i < primCount; i++)
+        {
+            if (intersectSphere(ray, geometry.spheres[primIndices[primOffset + i]], ray.maxT, hit))
+                return true;
+        }
+        return false;
+    }
+
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        const uint3& t = geometry.indices[primIndices[primOffset + i]];
+        if (IntersectTriangle(ray, geometry.vertices[t.x], geometry.vertices[t.y], geometry.vertices[t.z], ray.maxT, hit))
+            return true;
+    }
+    return false;
+}
+
+// IntersectGeometry with anyHit set for occlusion queries: the first triangle within ray.maxT ends the traversal and no
+// hit record is computed. Wide layouts visit the children in the occlusion order of TraverseBvh8Occlusion.
+// rootIndex starts the traversal in a subtree of the traversed layout, it is ignored for the motion path.
+bool OccludedGeometry(const HostGeometry& geometry, const hiprtRay& ray, float time, bool interpolate, uint32_t rootIndex = 0)
+{
+    if (interpolate && !geometry.motionBvh.bvh.nodes.empty())
+    {
+        float maxT = ray.maxT;
+        hiprtHit hit;
+        return IntersectGeometry(geometry, ray, time, true, true, maxT, hit);
+    }
+
+    if (rootIndex == 0 && (!geometry.compressedBvh8.nodes.empty() || !geometry.bvh8.nodes.empty()) && MissesRootObb(geometry, ray, ray.maxT))
+        return false;
+    if (!geometry.compressedBvh8.nodes.empty())
+    {
+        auto leafFunc = [&](uint32_t primOffset, uint32_t primCount) { return OccludedLeaf(geometry, geometry.compressedBvh8.primIndices, primOffset, primCount, ray); };
+        return TraverseBvh8Occlusion(geometry.compressedBvh8, ray, ray.maxT, leafFunc, rootIndex);
+    }
+    if (!geometry.bvh8.nodes.empty())
+    {
+        auto leafFunc = [&](uint32_t primOffset, uint32_t primCount) { return OccludedLeaf(geometry, geometry.bvh8.primIndices, primOffset, primCount, ray); };
+        return TraverseBvh8Occlusion(geometry.bvh8, ray, ray.maxT, leafFunc, rootIndex);
+    }
+
+    bool occluded = false;
+    float maxT = ray.maxT;
+    auto leafFunc = [&](uint32_t primOffset, uint32_t primCount, float&) {
+        occluded = OccludedLeaf(geometry, geometry.bvh.primIndices, primOffset, primCount, ray);
+        return occluded;
+    };
+    if (!geometry.obbs.empty())
+        TraverseBvhLeaves(GeometryObbView(geometry), ray, maxT, leafFunc, rootIndex);
+    else
+        TraverseBvhLeaves(geometry.bvh, ray, maxT, leafFunc, rootIndex);
+    return occluded;
+}
+
+// triangles are fitted by their corners, spheres by their centers grown by the radius
+ObbFitInput GeometryFitInput(const HostGeometry& geometry)
+{
+    ObbFitInput input;
+    if (geometry.spheres != nullptr)
+    {
+        input.points.assign(geometry.spheres, geometry.spheres + geometry.sphereCount);
+        input.offsets.resize(geometry.sphereCount + 1);
+        for (uint32_t i = 0; i <= geometry.sphereCount; i++) input.offsets[i] = i;
+        return input;
+    }
+
+    input.points.resize(3 * geometry.triangleCount);
+    input.offsets.resize(geometry.triangleCount + 1);
+    for (uint32_t i = 0; i < geometry.triangleCount; i++)
+    {
+        const uint3& t = geometry.indices[i];
+        input.points[3 * i + 0] = make_float4(geometry.vertices[t.x], 0.0f);
+        input.points[3 * i + 1] = make_float4(geometry.vertices[t.y], 0.0f);
+        input.points[3 * i + 2] = make_float4(geometry.vertices[t.z], 0.0f);
+        input.offsets[i] = 3 * i;
+    }
+    input.offsets[geometry.triangleCount] = 3 * geometry.triangleCount;
+    return input;
+}
+
+// the wide layouts, the triangle leaves and the primitive leaves are rebuilt from the binary tree, which is a linear pass
+bool CollapseGeometry(const BvhBuildOptions& options, HostGeometry& geometry)
+{
+    geometry.primLeaves.assign(geometry.triangleCount + geometry.sphereCount, 0);
+    for (uint32_t i = 0; i < geometry.bvh.nodes.size(); i++)
+    {
+        const BvhNode& node = geometry.bvh.nodes[i];
+        for (uint32_t p = 0; p < node.primCount; p++) geometry.primLeaves[geometry.bvh.primIndices[node.primOffset + p]] = i;
+    }
+
+    geometry.bvh8 = Bvh8{};
+    geometry.compressedBvh8 = CompressedBvh8{};
+    geometry.layoutNodes.clear();
+    if (options.wideBvh)
+    {
+        if (CollapseBvh8(geometry.bvh, geometry.bvh8, &geometry.layoutNodes) == false)
+            return false;
+        if (options.compressWideBvh)
+        {
+            std::vector<uint32_t> compressedNodes;
+            if (CompressBvh8(geometry.bvh8, geometry.compressedBvh8, &compressedNodes) == false)
+                return false;
+            for (uint32_t& node : geometry.layoutNodes) node = compressedNodes[node];
+            geometry.bvh8 = Bvh8{};
+        }
+    }
+
+    // the fit follows every refit, the wide layouts only use the root box
+    geometry.obbs = BvhObbs{};
+    const bool wide = !geometry.bvh8.nodes.empty() || !geometry.compressedBvh8.nodes.empty();
+    const uint32_t obbLevels = wide ? std::min(options.orientedBlasLevels, 1u) : options.orientedBlasLevels;
+    if (obbLevels > 0 && BuildBvhObbs(geometry.bvh, GeometryFitInput(geometry), obbLevels, options, geometry.obbs) == false)
+        return false;
+
+    if (!options.triangleLeaves || geometry.spheres != nullptr)
+        return true;
+    if (!geometry.compressedBvh8.nodes.empty())
+        return BuildTriangleLeaves(geometry.vertices, geometry.indices, geometry.compressedBvh8, geometry.triangleLeaves);
+    if (!geometry.bvh8.nodes.empty())
+        return BuildTriangleLeaves(geometry.vertices, geometry.indices, geometry.bvh8, geometry.triangleLeaves);
+    return BuildTriangleLeaves(geometry.vertices, geometry.indices, geometry.bvh, geometry.triangleLeaves);
+}
+
+// Builds or loads from the cache the Bvh and builds the traversed layouts of one mesh, treeletSah receives the SAH cost
+// before and after the treelet restructuring when it ran
+bool BuildHostGeometry(TriangleMesh& mesh, const BvhBuildOptions& options, BvhBuildScratch& scratch, HostGeometry& geometry, float2& treeletSah)
+{
+    geometry.vertices = mesh.vertices.data();
+    geometry.indices = mesh.indices.data();
+    geometry.vertexCount = mesh.GetNumVertices();
+    geometry.triangleCount = static_cast<uint32_t>(mesh.indices.size());
+
+    // sphere lists are boxes to the builders, spatial splits only know how to clip triangles. The cache key only covers
+    // triangles, so they are built every time.
+    if (!mesh.spheres.empty())
+    {
+        geometry.spheres = mesh.spheres.data();
+        geometry.sphereCount = static_cast<uint32_t>(mesh.spheres.size());
+        BvhBuildOptions sphereOptions = options;
+        if (sphereOptions.buildType == BVH_BUILD_TYPE::SPATIAL_SPLITS)
+            sphereOptions.buildType = BVH_BUILD_TYPE::BINNED_SAH;
+
+        mesh.BuildAABB();
+        if (BuildBvh(mesh.aabb, sphereOptions, geometry.bvh, &scratch) == false)
+            return false;
+        if (options.treeletRounds > 0 && OptimizeBvhTreelets(geometry.bvh, options, &treeletSah.x, &treeletSah.y) == false)
+            return false;
+        if (options.depthFirstLayout && ReorderBvhDepthFirst(geometry.bvh) == false)
+            return false;
+        geometry.buildSahCost = ComputeSahCost(geometry.bvh, options);
+        return CollapseGeometry(options, geometry);
+    }
+
+    // a cached tree is the finished binary Bvh, only the layouts derived from it are rebuilt
+    uint64_t cacheKey = 0;
+    bool cached = false;
+    if (!options.cacheDirectory.empty())
+    {
+        cacheKey = ComputeBvhCacheKey(geometry.vertices, geometry.vertexCount, geometry.indices, geometry.triangleCount, options);
+        cached = LoadCachedBvh(options.cacheDirectory, cacheKey, geometry.triangleCount, geometry.bvh, geometry.buildSahCost);
+    }
+
+    if (!cached)
+    {
+        mesh.BuildAABB();
+        if (BuildTriangleBvh(geometry.vertices, geometry.indices, geometry.triangleCount, mesh.aabb, options, geometry.bvh, &scratch) == false)
+            return false;
+        if (options.treeletRounds > 0 && OptimizeBvhTreelets(geometry.bvh, options, &treeletSah.x, &treeletSah.y) == false)
+            return false;
+        if (options.depthFirstLayout && ReorderBvhDepthFirst(geometry.bvh) == false)
+            return false;
+        geometry.buildSahCost = ComputeSahCost(geometry.bvh, options);
+        // a cache that cannot be written only costs the next run the build
+        if (!options.cacheDirectory.empty())
+            StoreCachedBvh(options.cacheDirectory, cacheKey, geometry.bvh, geometry.buildSahCost);
+    }
+    if (CollapseGeometry(options, geometry) == false)
+        return false;
+
+    geometry.keyFrameVertices = mesh.vertices.data();
+    geometry.keyFrameCount = mesh.deformation_count;
+    if (mesh.deformation_count > 1 &&
+        BuildMotionBvh(geometry.keyFrameVertices, geometry.vertexCount, geometry.keyFrameCount, geometry.indices, geometry.triangleCount, options, geometry.motionBvh) == false)
+        return false;
+    return true;
+}
+
+// object space bounds of everything the geometry can be traced as, over all deformation key frames
+hiprt::Aabb GeometryBounds(const HostGeometry& geometry)
+{
+    if (!geometry.motionBvh.bvh.nodes.empty())
+        return geometry.motionBvh.bvh.nodes[0].box;
+    if (!geometry.bvh.nodes.empty())
+        return geometry.bvh.nodes[0].box;
+    return hiprt::Aabb();
+}
+
+bool BuildTlas(HostScene& scene)
+{
+    std::vector<hiprt::Aabb> instanceBoxes(scene.instances.size());
+    for (size_t i = 0; i < scene.instances.size(); i++)
+    {
+        const HostInstance& instance = scene.instances[i];
+        instanceBoxes[i] = ComputeMotionBounds(GeometryBounds(scene.geometries[instance.geometry]), &scene.frames[instance.transform.frameIndex], instance.transform.frameCount);
+    }
+
+    // few and large boxes, the spatial split builder only knows triangles
+    BvhBuildOptions options = scene.options;
+    if (options.buildType == BVH_BUILD_TYPE::SPATIAL_SPLITS)
+        options.buildType = BVH_BUILD_TYPE::BINNED_SAH;
+    scene.tlasObbs = BvhObbs{};
+    if (BuildBvh(instanceBoxes, options, scene.tlas) == false)
+        return false;
+    if (!options.orientedTlas)
+        return true;
+
+    // a static instance is fitted by the corners of its object box in world space and its rotation is tried as box
+    // frame, which fits it exactly. Moving instances only have their swept Aabb.
+    std::vector<float> geometryCosts(scene.geometries.size(), 0.0f);
+    for (size_t g = 0; g < scene.geometries.size(); g++)
+    {
+        if (!scene.geometries[g].bvh.nodes.empty())
+            geometryCosts[g] = ComputeSahCost(scene.geometries[g].bvh, options);
+    }
+    ObbFitInput input;
+    input.offsets.push_back(0);
+    input.costs.resize(scene.instances.size());
+    input.rotations.resize(scene.instances.size());
+    for (size_t i = 0; i < scene.instances.size(); i++)
+    {
+        const HostInstance& instance = scene.instances[i];
+        const hiprtFrameSRT& frame = scene.frames[instance.transform.frameIndex];
+        const bool moving = instance.transform.frameCount > 1;
+        const hiprt::Aabb box = moving ? instanceBoxes[i] : GeometryBounds(scene.geometries[instance.geometry]);
+        const SrtTransform transform = ToSrtTransform(frame);
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            const float3 corner = make_float3(c & 1 ? box.m_max.x : box.m_min.x, c & 2 ? box.m_max.y : box.m_min.y, c & 4 ? box.m_max.z : box.m_min.z);
+            input.points.push_back(make_float4(moving ? corner : TransformPoint(transform, corner), 0.0f));
+        }
+        input.offsets.push_back(static_cast<uint32_t>(input.points.size()));
+        input.costs[i] = geometryCosts[instance.geometry];
+        input.rotations[i] = moving ? make_float4(0.0f, 0.0f, 0.0f, 1.0f) : transform.rotation;
+    }
+    return BuildBvhObbs(scene.tlas, input, MaxBvhDepth, options, scene.tlasObbs);
+}
+
+// instanceFunc(instanceIndex, geometry, objectRay, transform, maxT) is called for the instances of the visited TLAS
+// leaves with the ray in the object space of the instance at the ray time, same return contract as the leaf functions
+template<typename InstanceFunc>
+void TraverseInstances(const HostScene& scene, const hiprtRay& ray, float time, float& maxT, InstanceFunc&& instanceFunc)
+{
+    auto leafFunc = [&](uint32_t instanceIndex, float& leafMaxT) {
+        const HostInstance& instance = scene.instances[instanceIndex];
+        const SrtTransform transform = InterpolateFrames(&scene.frames[instance.transform.frameIndex], instance.transform.frameCount, time);
+        return instanceFunc(instanceIndex, scene.geometries[instance.geometry], InverseTransformRay(transform, ray), transform, leafMaxT);
+    };
+    if (!scene.tlasObbs.empty())
+        TraverseBvh(ObbBvhView{scene.tlas.nodes, scene.tlas.primIndices, scene.tlasObbs}, ray, maxT, leafFunc);
+    else
+        TraverseBvh(scene.tlas, ray, maxT, leafFunc);
+}
+
+inline bool SphereOverlapsBox(const float3& center, float radius, const hiprt::Aabb& box)
+{
+    const float dx = std::max(std::max(box.m_min.x - center.x, center.x - box.m_max.x), 0.0f);
+    const float dy = std::max(std::max(box.m_min.y - center.y, center.y - box.m_max.y), 0.0f);
+    const float dz = std::max(std::max(box.m_min.z - center.z, center.z - box.m_max.z), 0.0f);
+    return dx * dx + dy * dy + dz * dz <= radius * radius;
+}
+
+inline bool BoxContainsSphere(const hiprt::Aabb& box, const float3& center, float radius)
+{
+    return box.m_min.x <= center.x - radius && box.m_min.y <= center.y - radius && box.m_min.z <= center.z - radius && box.m_max.x >= center.x + radius &&
+           box.m_max.y >= center.y + radius && box.m_max.z >= center.z + radius;
+}
+
+} // namespace
+
+bool CreateHostScene(std::vector<TriangleMesh>& meshes, const BvhBuildOptions& options, HostScene& scene)
+{
+    scene.options = options;
+    scene.geometries.clear();
+    scene.geometries.resize(meshes.size());
+
+    const uint32_t geometryCount = static_cast<uint32_t>(meshes.size());
+    std::vector<uint32_t> order(geometryCount);
+    std::vector<float2> treeletSah(geometryCount, make_float2(0.0f));
+    uint64_t totalTriangles = 0;
+    for (uint32_t i = 0; i < geometryCount; i++)
+    {
+        order[i] = i;
+        totalTriangles += meshes[i].indices.size();
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return meshes[a].indices.size() > meshes[b].indices.size(); });
+
+    // Meshes with more than a fair share of the triangles are built one after the other, each on all cores. The rest
+    // go to the workers largest first, one build per worker with the nested loops inline, so the small ones fill in
+    // around the big ones instead of queueing behind them. Each worker reuses one scratch for all of its builds.
+    const uint32_t workerCount = GetWorkerCount();
+    const uint64_t fairShare = totalTriangles / workerCount;
+    uint32_t largeCount = 0;
+    while (largeCount < geometryCount && meshes[order[largeCount]].indices.size() > fairShare) largeCount++;
+
+    std::vector<BvhBuildScratch> scratch(workerCount);
+    for (uint32_t i = 0; i < largeCount; i++)
+    {
+        if (BuildHostGeometry(meshes[order[i]], options, scratch[0], scene.geometries[order[i]], treeletSah[order[i]]) == false)
+            return false;
+    }
+
+    std::atomic<bool> failed{false};
+    ParallelFor(
+        geometryCount - largeCount,
+        [&](uint32_t item, uint32_t worker) {
+            const uint32_t g = order[largeCount + item];
+            if (!failed.load(std::memory_order_relaxed) && BuildHostGeometry(meshes[g], options, scratch[worker], scene.geometries[g], treeletSah[g]) == false)
+                failed = true;
+        },
+        workerCount);
+    if (failed)
+        return false;
+
+    if (options.treeletRounds > 0)
+    {
+        // geometries loaded from the cache did not run the pass and report nothing
+        for (uint32_t i = 0; i < geometryCount; i++)
+        {
+            if (treeletSah[i].x > 0.0f)
+                std::cout << "Geometry " << i << " treelet restructuring: SAH " << treeletSah[i].x << " -> " << treeletSah[i].y << "\n";
+        }
+    }
+
+    scene.instances.clear();
+    scene.frames.clear();
+    scene.tlas = Bvh{};
+    return true;
+}
+
+bool CreateHostInstances(const std::vector<HostInstance>& instances, const std::vector<hiprtFrameSRT>& frames, HostScene& scene)
+{
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        const HostInstance& instance = instances[i];
+        if (instance.geometry >= scene.geometries.size())
+        {
+            std::cerr << "Host instances: instance " << i << " references a missing geometry\n";
+            return false;
+        }
+        if (instance.transform.frameCount == 0 || instance.transform.frameIndex + instance.transform.frameCount > frames.size())
+        {
+            std::cerr << "Host instances: instance " << i << " has an invalid frame range\n";
+            return false;
+        }
+    }
+
+    scene.instances = instances;
+    scene.frames = frames;
+    return BuildTlas(scene);
+}
+
+bool RefitHostScene(std::vector<TriangleMesh>& meshes, uint32_t deformation, HostScene& scene, float& maxDegradation)
+{
+    maxDegradation = 1.0f;
+    if (meshes.size() != scene.geometries.size())
+    {
+        std::cerr << "Host scene refit: mesh count does not match the scene\n";
+        return false;
+    }
+
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        TriangleMesh& mesh = meshes[i];
+        HostGeometry& geometry = scene.geometries[i];
+        if (deformation >= mesh.deformation_count)
+        {
+            std::cerr << "Host scene refit: mesh " << i << " has no deformation " << deformation << "\n";
+            return false;
+        }
+
+        geometry.vertices = mesh.vertices.data() + deformation * geometry.vertexCount;
+        mesh.BuildAABB(deformation);
+        if (RefitBvh(mesh.aabb, geometry.bvh) == false)
+            return false;
+        maxDegradation = std::max(maxDegradation, ComputeRefitDegradation(geometry.bvh, geometry.buildSahCost, scene.options));
+        if (CollapseGeometry(scene.options, geometry) == false)
+            return false;
+    }
+
+    // the instance bounds follow the new BLAS boxes, the TLAS is small enough to rebuild
+    if (!scene.instances.empty())
+        return BuildTlas(scene);
+    return true;
+}
+
+// Moller-Trumbore, same as IntersectTriangle in trace.cpp but reports the geometric normal
+bool IntersectTriangle(const hiprtRay& ray, const float3& p0, const float3& p1, const float3& p2, float maxT, hiprtHit& hit)
+{
+    float3 e1 = p1 - p0;
+    float3 e2 = p2 - p0;
+    float3 s1 = hiprt::cross(ray.direction, e2);
+
+    float denom = hiprt::dot(s1, e1);
+    if (denom == 0.f)
+        return false;
+
+    float invd = 1.0f / denom;
+    float3 d = ray.origin - p0;
+    float b1 = hiprt::dot(d, s1) * invd;
+    if ((b1 < 0.f) || (b1 > 1.f))
+        return false;
+
+    float3 s2 = hiprt::cross(d, e1);
+    float b2 = hiprt::dot(ray.direction, s2) * invd;
+    if ((b2 < 0.f) || (b1 + b2 > 1.f))
+        return false;
+
+    float t = hiprt::dot(e2, s2) * invd;
+    if ((t < ray.minT) || (t > maxT))
+        return false;
+
+    hit.t = t;
+    hit.uv.x = b1;
+    hit.uv.y = b2;
+    hit.normal = hiprt::cross(e1, e2);
+    return true;
+}
+
+bool TraceClosest(const HostScene& scene, const hiprtRay& ray, hiprtHit& hit)
+{
+    if (!scene.instances.empty())
+        return TraceClosest(scene, ray, 0.0f, hit);
+
+    hit = hiprtHit{};
+    float closest = ray.maxT;
+    for (uint32_t g = 0; g < scene.geometries.size(); g++)
+    {
+        if (IntersectGeometry(scene.geometries[g], ray, 0.0f, false, false, closest, hit))
+            hit.instanceID = g;
+    }
+    return hit.hasHit();
+}
+
+bool TraceAnyHit(const HostScene& scene, const hiprtRay& ray)
+{
+    if (!scene.instances.empty())
+        return TraceAnyHit(scene, ray, 0.0f);
+
+    for (const auto& geometry : scene.geometries)
+    {
+        if (OccludedGeometry(geometry, ray, 0.0f, false))
+            return true;
+    }
+    return false;
+}
+
+void TraceClosestPacket(const HostScene& scene, RayPacket& packet, uint64_t activeMask, hiprtHit* hits)
+{
+    for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1) hits[std::countr_zero(mask)] = hiprtHit{};
+
+    if (!scene.instances.empty())
+    {
+        for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+        {
+            const uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+            TraceClosest(scene, GetPacketRay(packet, i), hits[i]);
+        }
+        return;
+    }
+
+    alignas(32) float t[RayGroupSize];
+    alignas(32) float u[RayGroupSize];
+    alignas(32) float v[RayGroupSize];
+    for (uint32_t g = 0; g < scene.geometries.size(); g++)
+    {
+        const HostGeometry& geometry = scene.geometries[g];
+        if (geometry.spheres != nullptr)
+        {
+            // the packet intersector is triangles only, sphere lists are traced one ray at a time
+            for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+            {
+                const uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+                if (IntersectGeometry(geometry, GetPacketRay(packet, i), 0.0f, false, false, packet.maxT[i], hits[i]))
+                    hits[i].instanceID = g;
+            }
+            continue;
+        }
+        TraverseBvhPacket(geometry.bvh, packet, activeMask, [&](uint32_t primOffset, uint32_t primCount, uint64_t rayMask) {
+            for (uint32_t p = 0; p < primCount; p++)
+            {
+                const uint32_t primIndex = geometry.bvh.primIndices[primOffset + p];
+                const uint3& triangle = geometry.indices[primIndex];
+                const float3 p0 = geometry.vertices[triangle.x];
+                const float3 e1 = geometry.vertices[triangle.y] - p0;
+                const float3 e2 = geometry.vertices[triangle.z] - p0;
+                for (uint32_t group = 0; group < RayPacketSize / RayGroupSize; group++)
+                {
+                    const uint32_t groupMask = static_cast<uint32_t>(rayMask >> (group * RayGroupSize)) & 0xff;
+                    if (groupMask == 0)
+                        continue;
+
+                    for (uint32_t hitMask = IntersectTrianglePacket(packet, group, p0, e1, e2, t, u, v) & groupMask; hitMask != 0; hitMask &= hitMask - 1)
+                    {
+                        const uint32_t lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+                        const uint32_t i = group * RayGroupSize + lane;
+                        hiprtHit& hit = hits[i];
+                        hit.t = t[lane];
+                        hit.uv.x = u[lane];
+                        hit.uv.y = v[lane];
+                        hit.normal = hiprt::cross(e1, e2);
+                        hit.primID = primIndex;
+                        hit.instanceID = g;
+                        packet.maxT[i] = t[lane];
+                    }
+                }
+            }
+        });
+    }
+}
+
+void TraceAnyHitStream(const HostScene& scene, const RayStream& stream, uint8_t* occluded)
+{
+    for (const uint32_t rayIndex : stream.order) occluded[rayIndex] = TraceAnyHit(scene, stream.rays[rayIndex]) ? 1 : 0;
+}
+
+void FindOcclusionRegion(const HostScene& scene, const hiprtHit& hit, const float3& center, float radius, OcclusionRegion& region)
+{
+    region.center = center;
+    region.radius = radius;
+    region.entryCount = 0;
+    region.bounded = scene.instances.empty();
+    if (!region.bounded)
+        return;
+
+    // slack for unit directions that come out slightly longer than one
+    radius *= 1.0f + 1.0e-4f;
+
+    uint32_t candidates[MaxOcclusionEntries];
+    for (uint32_t g = 0; g < scene.geometries.size(); g++)
+    {
+        const HostGeometry& geometry = scene.geometries[g];
+        const std::vector<BvhNode>& nodes = geometry.bvh.nodes;
+        if (nodes.empty() || !SphereOverlapsBox(center, radius, nodes[0].box))
+            continue;
+        if (region.entryCount == MaxOcclusionEntries)
+        {
+            // no room left for this geometry, the rays take the full traversal
+            region.bounded = false;
+            return;
+        }
+
+        uint32_t node = 0;
+        if (g == hit.instanceID && hit.primID < geometry.primLeaves.size())
+        {
+            node = geometry.primLeaves[hit.primID];
+            while (node != 0 && !BoxContainsSphere(nodes[node].box, center, radius)) node = nodes[node].parent;
+        }
+
+        // the siblings along the path to the root can touch the sphere as well, with too many of them the whole tree
+        // is a single entry
+        const uint32_t room = MaxOcclusionEntries - region.entryCount - 1;
+        uint32_t candidateCount = 0;
+        for (uint32_t child = node; child != 0; child = nodes[child].parent)
+        {
+            const BvhNode& parent = nodes[nodes[child].parent];
+            const uint32_t sibling = parent.child[0] == child ? parent.child[1] : parent.child[0];
+            if (!SphereOverlapsBox(center, radius, nodes[sibling].box))
+                continue;
+            if (candidateCount == room)
+            {
+                node = 0;
+                candidateCount = 0;
+                break;
+            }
+            candidates[candidateCount++] = sibling;
+        }
+
+        region.geometry[region.entryCount] = g;
+        region.node[region.entryCount++] = node;
+
+        // a candidate is opened into its children that touch the sphere while the entries have room for both
+        const uint32_t firstEntry = region.entryCount - 1;
+        while (candidateCount > 0)
+        {
+            const BvhNode& candidate = nodes[candidates[--candidateCount]];
+            if (candidate.IsLeaf() || region.entryCount + candidateCount + 2 > MaxOcclusionEntries)
+            {
+                region.geometry[region.entryCount] = g;
+                region.node[region.entryCount++] = candidates[candidateCount];
+                continue;
+            }
+            for (uint32_t c = 0; c < 2; c++)
+            {
+                if (SphereOverlapsBox(center, radius, nodes[candidate.child[c]].box))
+                    candidates[candidateCount++] = candidate.child[c];
+            }
+        }
+
+        // wide layouts start at the node that covers the binary one, entries that land on the same node are merged
+        if (!geometry.layoutNodes.empty())
+        {
+            uint32_t entryCount = firstEntry;
+            for (uint32_t i = firstEntry; i < region.entryCount; i++)
+            {
+                const uint32_t layoutNode = geometry.layoutNodes[region.node[i]];
+                if (std::find(region.node + firstEntry, region.node + entryCount, layoutNode) == region.node + entryCount)
+                    region.node[entryCount++] = layoutNode;
+            }
+            region.entryCount = entryCount;
+        }
+    }
+}
+
+bool TraceAnyHit(const HostScene& scene, const OcclusionRegion& region, const hiprtRay& ray)
+{
+    if (!region.bounded)
+        return TraceAnyHit(scene, ray);
+
+    for (uint32_t i = 0; i < region.entryCount; i++)
+    {
+        if (OccludedGeometry(scene.geometries[region.geometry[i]], ray, 0.0f, false, region.node[i]))
+            return true;
+    }
+    return false;
+}
+
+bool TraceClosest(const HostScene& scene, const hiprtRay& ray, float time, hiprtHit& hit)
+{
+    hit = hiprtHit{};
+    float closest = ray.maxT;
+    if (!scene.instances.empty())
+    {
+        TraverseInstances(scene, ray, time, closest, [&](uint32_t instanceIndex, const HostGeometry& geometry, const hiprtRay& objectRay, const SrtTransform& transform, float& maxT) {
+            if (IntersectGeometry(geometry, objectRay, time, true, false, maxT, hit))
+            {
+                hit.instanceID = instanceIndex;
+                hit.normal = TransformNormal(transform, hit.normal);
+            }
+            return false;
+        });
+        return hit.hasHit();
+    }
+
+    for (uint32_t g = 0; g < scene.geometries.size(); g++)
+    {
+        if (IntersectGeometry(scene.geometries[g], ray, time, true, false, closest, hit))
+            hit.instanceID = g;
+    }
+    return hit.hasHit();
+}
+
+bool TraceAnyHit(const HostScene& scene, const hiprtRay& ray, float time)
+{
+    if (!scene.instances.empty())
+    {
+        bool occluded = false;
+        float tMax = ray.maxT;
+        TraverseInstances(scene, ray, time, tMax, [&](uint32_t, const HostGeometry& geometry, const hiprtRay& objectRay, const SrtTransform&, float&) {
+            occluded = OccludedGeometry(geometry, objectRay, time, true);
+            return occluded;
+        });
+        return occluded;
+    }
+
+    for (const auto& geometry : scene.geometries)
+    {
+        if (OccludedGeometry(geometry, ray, time, true))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+#include "Bvh8.h"
+#include "CompressedBvh8.h"
+#include "MotionBvh.h"
+#include "Obb.h"
+#include "RayPacket.h"
+#include "RayStream.h"
+#include "Triangle8.h"
+#include "TriangleMesh.h"
+
+#include <vector>
+
+// Host side view of a triangle mesh. Buffers are borrowed from the TriangleMesh, which has to outlive the scene.
+struct HostGeometry
+{
+    const float3* vertices{nullptr};
+    const uint3* indices{nullptr};
+    uint32_t vertexCount{0};
+    uint32_t triangleCount{0};
+    // sphere lists have no triangles, the primitives of the Bvh are the analytic spheres of TriangleMesh::spheres
+    const float4* spheres{nullptr};
+    uint32_t sphereCount{0};
+    Bvh bvh;
+    // ComputeSahCost right after the full build, reference for the refit degradation
+    float buildSahCost{0.0f};
+    // empty unless BvhBuildOptions::wideBvh is set, compressedBvh8 replaces it when compressWideBvh is set as well
+    Bvh8 bvh8;
+    CompressedBvh8 compressedBvh8;
+    // leaves of the layout that is traversed, empty unless BvhBuildOptions::triangleLeaves is set
+    TriangleLeaves triangleLeaves;
+    // leaf of bvh that holds each primitive, where the search for an OcclusionRegion starts
+    std::vector<uint32_t> primLeaves;
+    // node of the traversed wide layout whose subtree covers each node of bvh, empty when bvh itself is traversed
+    std::vector<uint32_t> layoutNodes;
+    // oriented boxes of the top levels of bvh, see BvhBuildOptions::orientedBlasLevels. Only the root box is used when
+    // a wide layout is traversed, it culls rays before the first wide node.
+    BvhObbs obbs;
+
+    // deformed meshes: all key frames, frame major, and a motion Bvh over them
+    const float3* keyFrameVertices{nullptr};
+    uint32_t keyFrameCount{1};
+    MotionBvh motionBvh;
+};
+
+// Reference to one of the geometries, frames[frameIndex, frameIndex + frameCount) of the scene are its SRT key frames
+// sorted by time, same layout as the hiprtTransformHeader of the device scene
+struct HostInstance
+{
+    uint32_t geometry{0};
+    hiprtTransformHeader transform{0, 1};
+};
+
+struct HostScene
+{
+    std::vector<HostGeometry> geometries;
+    BvhBuildOptions options;
+
+    // two level scene when instances is not empty: the geometries are the BLAS and tlas is built over the instance
+    // bounds inflated over all their key frames, otherwise every geometry is traced with an identity transform
+    std::vector<HostInstance> instances;
+    std::vector<hiprtFrameSRT> frames;
+    Bvh tlas;
+    // empty unless BvhBuildOptions::orientedTlas is set and some instance is rotated enough to pay for it
+    BvhObbs tlasObbs;
+};
+
+// builds the per triangle boxes of every mesh and a Bvh over them
+bool CreateHostScene(std::vector<TriangleMesh>& meshes, const BvhBuildOptions& options, HostScene& scene);
+
+// Places the geometries of the scene with instances and builds the TLAS over them
+bool CreateHostInstances(const std::vector<HostInstance>& instances, const std::vector<hiprtFrameSRT>& frames, HostScene& scene);
+
+// Points the scene at the vertices of one deformation key frame and refits every Bvh instead of rebuilding it.
+// maxDegradation is the worst ComputeRefitDegradation over the geometries, the caller decides when to rebuild.
+bool RefitHostScene(std::vector<TriangleMesh>& meshes, uint32_t deformation, HostScene& scene, float& maxDegradation);
+
+bool IntersectTriangle(const hiprtRay& ray, const float3& p0, const float3& p1, const float3& p2, float maxT, hiprtHit& hit);
+
+// closest hit, hit.instanceID is the instance index, or the geometry index when the scene has no instances.
+// hit.normal is in world space.
+bool TraceClosest(const HostScene& scene, const hiprtRay& ray, hiprtHit& hit);
+
+// occlusion query, true as soon as any triangle blocks the ray within [minT, maxT], no hit record is computed
+bool TraceAnyHit(const HostScene& scene, const hiprtRay& ray);
+
+// TraceClosest for the rays of activeMask, hits[i] belongs to ray i. Flat scenes are traversed as a packet over the
+// binary Bvh of every geometry, scenes with instances ray by ray.
+void TraceClosestPacket(const HostScene& scene, RayPacket& packet, uint64_t activeMask, hiprtHit* hits);
+
+// TraceAnyHit for every ray of a sorted stream in the sorted order, occluded[i] belongs to stream.rays[i]. Rays that
+// follow each other visit mostly the same nodes and leaves, which are still in the cache from the ray before.
+void TraceAnyHitStream(const HostScene& scene, const RayStream& stream, uint8_t* occluded);
+
+constexpr uint32_t MaxOcclusionEntries = 32;
+
+// Subtrees of every geometry that can hold a triangle within radius of center, node indices of the traversed layout. Rays that start at
+// center with a unit direction and maxT <= radius only have to traverse these, never the top of the trees.
+// bounded is false for scenes with instances, TraceAnyHit then falls back to the full traversal.
+struct OcclusionRegion
+{
+    float3 center;
+    float radius;
+    bool bounded{false};
+    uint32_t entryCount{0};
+    uint32_t geometry[MaxOcclusionEntries];
+    uint32_t node[MaxOcclusionEntries];
+};
+
+// The search starts at the leaf of the primary hit and walks up to the smallest subtree whose box contains the sphere.
+// The subtrees hanging off the path from there to the root are added when their boxes touch the sphere and opened
+// with the same test as long as the entries have room.
+void FindOcclusionRegion(const HostScene& scene, const hiprtHit& hit, const float3& center, float radius, OcclusionRegion& region);
+
+// TraceAnyHit for a ray that starts at region.center, see OcclusionRegion
+bool TraceAnyHit(const HostScene& scene, const OcclusionRegion& region, const hiprtRay& ray);
+
+// Motion blur variants, deformed geometries are interpolated to the ray time in [0, 1] and traced through their
+// MotionBvh, instance transforms are interpolated between their SRT frames. The variants above trace the current
+// key frame only and the instances at time 0.
+bool TraceClosest(const HostScene& scene, const hiprtRay& ray, float time, hiprtHit& hit);
+
+bool TraceAnyHit(const HostScene& scene, const hiprtRay& ray, float time);
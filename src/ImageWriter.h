@@ -5,4 +5,7 @@
 
 void writeImage(const char* path, int w, int h, uint8_t* data);
 
+// flips rows, kernels write the image bottom up
+void writeImageFromHost(const char* path, int w, int h, const uint8_t* data);
+
 void writeImageFromDevice(const char* path, int w, int h, hiprtDevicePtr data);
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "Bvh.h"
+#include "Morton.h"
+#include "Parallel.h"
+#include "RadixSort.h"
+
+#include <bit>
+#include <iostream>
+#include <numeric>
+
+// Linear BVH (Karras 2012): primitives are sorted along a Morton curve and every inner node is emitted independently
+// from the sorted keys, so the build is a handful of linear passes that all run in parallel.
+
+namespace {
+
+constexpr uint32_t ChunkSize = 4096;
+
+// length of the common prefix of keys i and j, ties are broken by the key index
+template<typename Key>
+int32_t CommonPrefix(const std::vector<Key>& keys, int32_t i, int32_t j)
+{
+    if (j < 0 || j >= static_cast<int32_t>(keys.size()))
+        return -1;
+    const Key ki = keys[i];
+    const Key kj = keys[j];
+    if (ki == kj)
+        return static_cast<int32_t>(sizeof(Key) * 8 + std::countl_zero(static_cast<uint32_t>(i ^ j)));
+    return std::countl_zero(static_cast<Key>(ki ^ kj));
+}
+
+// inner nodes are nodes[0, n - 1), leaf k is nodes[n - 1 + k]
+template<typename Key>
+void EmitInnerNode(const std::vector<Key>& keys, int32_t i, std::vector<BvhNode>& nodes)
+{
+    const int32_t n = static_cast<int32_t>(keys.size());
+    const int32_t d = CommonPrefix(keys, i, i + 1) - CommonPrefix(keys, i, i - 1) > 0 ? 1 : -1;
+
+    // find the other end of the range covered by node i
+    const int32_t deltaMin = CommonPrefix(keys, i, i - d);
+    int32_t lMax = 2;
+    while (CommonPrefix(keys, i, i + lMax * d) > deltaMin) lMax *= 2;
+
+    int32_t l = 0;
+    for (int32_t t = lMax / 2; t >= 1; t /= 2)
+    {
+        if (CommonPrefix(keys, i, i + (l + t) * d) > deltaMin)
+            l += t;
+    }
+    const int32_t j = i + l * d;
+
+    // find the split position inside the range
+    const int32_t deltaNode = CommonPrefix(keys, i, j);
+    int32_t s = 0;
+    int32_t t = l;
+    do
+    {
+        t = (t + 1) / 2;
+        if (CommonPrefix(keys, i, i + (s + t) * d) > deltaNode)
+            s += t;
+    } while (t > 1);
+    const int32_t gamma = i + s * d + std::min(d, 0);
+
+    const uint32_t left = std::min(i, j) == gamma ? n - 1 + gamma : gamma;
+    const uint32_t right = std::max(i, j) == gamma + 1 ? n + gamma : gamma + 1;
+
+    nodes[i].child[0] = left;
+    nodes[i].child[1] = right;
+    nodes[left].parent = i;
+    nodes[right].parent = i;
+}
+
+template<typename Key>
+bool BuildLinear(const std::vector<hiprt::Aabb>& primBoxes, uint32_t keyBits, Bvh& bvh, std::vector<Key>& keys, std::vector<Key>& keysTmp, std::vector<uint32_t>& valuesTmp)
+{
+    const uint32_t primCount = static_cast<uint32_t>(primBoxes.size());
+    const uint32_t chunkCount = (primCount + ChunkSize - 1) / ChunkSize;
+
+    std::vector<hiprt::Aabb> partial(chunkCount);
+    ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min(primCount, (chunk + 1) * ChunkSize);
+        for (uint32_t i = chunk * ChunkSize; i < end; i++) partial[chunk].grow(primBoxes[i].center());
+    });
+    hiprt::Aabb centroidBox;
+    for (const auto& box : partial) centroidBox.grow(box);
+
+    const float3 extent = centroidBox.extent();
+    const float3 scale = make_float3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    keys.resize(primCount);
+    bvh.primIndices.resize(primCount);
+    ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min(primCount, (chunk + 1) * ChunkSize);
+        for (uint32_t i = chunk * ChunkSize; i < end; i++)
+        {
+            keys[i] = MortonCode<Key>((primBoxes[i].center() - centroidBox.m_min) * scale);
+            bvh.primIndices[i] = i;
+        }
+    });
+
+    RadixSortPairs(keys, bvh.primIndices, keyBits, keysTmp, valuesTmp);
+
+    const uint32_t innerCount = primCount - 1;
+    bvh.nodes.assign(innerCount + primCount, BvhNode{});
+
+    ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min(primCount, (chunk + 1) * ChunkSize);
+        for (uint32_t k = chunk * ChunkSize; k < end; k++)
+        {
+            BvhNode& leaf = bvh.nodes[innerCount + k];
+            leaf.primOffset = k;
+            leaf.primCount = 1;
+            if (k < innerCount)
+                EmitInnerNode(keys, static_cast<int32_t>(k), bvh.nodes);
+        }
+    });
+
+    // the hierarchy is complete, the boxes come from a bottom-up refit
+    return RefitBvh(primBoxes, bvh);
+}
+
+} // namespace
+
+bool BuildBvhLinear(const std::vector<hiprt::Aabb>& primBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch)
+{
+    bvh.nodes.clear();
+    bvh.primIndices.clear();
+
+    if (primBoxes.empty())
+    {
+        std::cerr << "Bvh build: no primitives\n";
+        return false;
+    }
+
+    if (primBoxes.size() == 1)
+    {
+        bvh.nodes.resize(1);
+        bvh.nodes[0].box = primBoxes[0];
+        bvh.nodes[0].primCount = 1;
+        bvh.primIndices.push_back(0);
+        return true;
+    }
+
+    BvhBuildScratch localScratch;
+    BvhBuildScratch& buffers = scratch != nullptr ? *scratch : localScratch;
+    if (options.mortonCodeBits == 30)
+        return BuildLinear<uint32_t>(primBoxes, 30, bvh, buffers.mortonCodes32, buffers.radixKeys32, buffers.radixValues);
+    if (options.mortonCodeBits == 63)
+        return BuildLinear<uint64_t>(primBoxes, 63, bvh, buffers.mortonCodes64, buffers.radixKeys64, buffers.radixValues);
+
+    std::cerr << "Bvh build: morton code has to be 30 or 63 bits\n";
+    return false;
+}
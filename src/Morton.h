@@ -0,0 +1,47 @@
+#pragma once
+
+#include "../kernels/shared.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// Morton codes interleave the quantized coordinates of a point, 10 bits per axis in 32 bit keys and 21 in 64 bit keys
+
+inline uint32_t ExpandBits10(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+inline uint64_t ExpandBits21(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffull;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+template<typename Key>
+Key MortonCode(const float3& p);
+
+// p is normalized to [0, 1]
+template<>
+inline uint32_t MortonCode<uint32_t>(const float3& p)
+{
+    auto quantize = [](float v) { return static_cast<uint32_t>(std::min(std::max(v * 1024.0f, 0.0f), 1023.0f)); };
+    return (ExpandBits10(quantize(p.x)) << 2) | (ExpandBits10(quantize(p.y)) << 1) | ExpandBits10(quantize(p.z));
+}
+
+template<>
+inline uint64_t MortonCode<uint64_t>(const float3& p)
+{
+    auto quantize = [](float v) { return static_cast<uint64_t>(std::min(std::max(v * 2097152.0f, 0.0f), 2097151.0f)); };
+    return (ExpandBits21(quantize(p.x)) << 2) | (ExpandBits21(quantize(p.y)) << 1) | ExpandBits21(quantize(p.z));
+}
@@ -0,0 +1,70 @@
+#include "MotionBvh.h"
+#include "Parallel.h"
+
+#include <iostream>
+
+namespace {
+
+constexpr uint32_t ChunkSize = 4096;
+
+void BuildTriangleBoxes(const float3* frame, const uint3* indices, uint32_t triangleCount, std::vector<hiprt::Aabb>& boxes)
+{
+    boxes.resize(triangleCount);
+    ParallelFor((triangleCount + ChunkSize - 1) / ChunkSize, [&](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min(triangleCount, (chunk + 1) * ChunkSize);
+        for (uint32_t i = chunk * ChunkSize; i < end; i++)
+        {
+            const uint3& t = indices[i];
+            boxes[i] = hiprt::Aabb(frame[t.x]).grow(frame[t.y]).grow(frame[t.z]);
+        }
+    });
+}
+
+} // namespace
+
+bool BuildMotionBvh(const float3* vertices,
+                    uint32_t vertexCount,
+                    uint32_t keyFrameCount,
+                    const uint3* indices,
+                    uint32_t triangleCount,
+                    const BvhBuildOptions& options,
+                    MotionBvh& motionBvh)
+{
+    motionBvh.keyFrameBoxes.clear();
+    motionBvh.keyFrameCount = keyFrameCount;
+    if (keyFrameCount == 0)
+    {
+        std::cerr << "Motion bvh build: no key frames\n";
+        return false;
+    }
+
+    // topology over the boxes of the whole key frame range
+    std::vector<std::vector<hiprt::Aabb>> frameBoxes(keyFrameCount);
+    for (uint32_t frame = 0; frame < keyFrameCount; frame++) BuildTriangleBoxes(vertices + frame * vertexCount, indices, triangleCount, frameBoxes[frame]);
+
+    std::vector<hiprt::Aabb> unionBoxes = frameBoxes[0];
+    for (uint32_t frame = 1; frame < keyFrameCount; frame++)
+    {
+        for (uint32_t i = 0; i < triangleCount; i++) unionBoxes[i].grow(frameBoxes[frame][i]);
+    }
+
+    // spatial splits clip the triangles of one pose, they do not carry over to the other key frames
+    BvhBuildOptions topologyOptions = options;
+    if (topologyOptions.buildType == BVH_BUILD_TYPE::SPATIAL_SPLITS)
+        topologyOptions.buildType = BVH_BUILD_TYPE::BINNED_SAH;
+    if (BuildBvh(unionBoxes, topologyOptions, motionBvh.bvh) == false)
+        return false;
+
+    // the per key frame boxes are refits of the same topology
+    const uint32_t nodeCount = static_cast<uint32_t>(motionBvh.bvh.nodes.size());
+    motionBvh.keyFrameBoxes.resize(static_cast<size_t>(nodeCount) * keyFrameCount);
+    Bvh frameBvh = motionBvh.bvh;
+    for (uint32_t frame = 0; frame < keyFrameCount; frame++)
+    {
+        if (RefitBvh(frameBoxes[frame], frameBvh) == false)
+            return false;
+        for (uint32_t node = 0; node < nodeCount; node++) motionBvh.keyFrameBoxes[node * keyFrameCount + frame] = frameBvh.nodes[node].box;
+    }
+
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+
+#include <algorithm>
+#include <vector>
+
+// Binary Bvh with a box per node and deformation key frame. The topology is built once over the boxes that bound all
+// key frames, traversal interpolates the boxes of the two key frames around the ray time. Vertices move linearly
+// between key frames, so the interpolated box bounds the geometry at that time and a ray only visits the nodes that
+// overlap it then, not the union over the whole shutter.
+struct MotionBvh
+{
+    // topology, the node boxes bound all key frames
+    Bvh bvh;
+    uint32_t keyFrameCount{0};
+    // keyFrameBoxes[node * keyFrameCount + frame]
+    std::vector<hiprt::Aabb> keyFrameBoxes;
+};
+
+// vertices are frame major, vertices[frame * vertexCount + v], the layout ApplyDeformation produces
+bool BuildMotionBvh(const float3* vertices,
+                    uint32_t vertexCount,
+                    uint32_t keyFrameCount,
+                    const uint3* indices,
+                    uint32_t triangleCount,
+                    const BvhBuildOptions& options,
+                    MotionBvh& motionBvh);
+
+struct KeyFrameTime
+{
+    uint32_t frame0;
+    uint32_t frame1;
+    float t;
+};
+
+// same mapping of the ray time in [0, 1] to key frames as IntersectDeformation in trace.cpp
+inline KeyFrameTime GetKeyFrameTime(uint32_t keyFrameCount, float time)
+{
+    const float timeScaled = (keyFrameCount - 1) * std::min(std::max(time, 0.0f), 0.99999f);
+    KeyFrameTime keyTime;
+    keyTime.frame0 = static_cast<uint32_t>(timeScaled);
+    keyTime.frame1 = std::min(keyTime.frame0 + 1, keyFrameCount - 1);
+    keyTime.t = timeScaled - keyTime.frame0;
+    return keyTime;
+}
+
+inline hiprt::Aabb LerpBox(const hiprt::Aabb& a, const hiprt::Aabb& b, float t)
+{
+    return hiprt::Aabb(a.m_min + (b.m_min - a.m_min) * t, a.m_max + (b.m_max - a.m_max) * t);
+}
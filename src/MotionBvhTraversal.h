@@ -0,0 +1,76 @@
+#pragma once
+
+#include "MotionBvh.h"
+
+// TraverseBvh with the node boxes interpolated to the ray time
+template<typename LeafFunc>
+void TraverseMotionBvh(const MotionBvh& motionBvh, const hiprtRay& ray, float time, float& maxT, LeafFunc&& leafFunc)
+{
+    const Bvh& bvh = motionBvh.bvh;
+    if (bvh.nodes.empty())
+        return;
+
+    const float3 invD = hiprt::safeInv(ray.direction);
+    const float3 oxInvD = -ray.origin * invD;
+
+    const uint32_t keyFrameCount = motionBvh.keyFrameCount;
+    const KeyFrameTime keyTime = GetKeyFrameTime(keyFrameCount, time);
+    auto nodeBox = [&](uint32_t node) {
+        const hiprt::Aabb* boxes = &motionBvh.keyFrameBoxes[node * keyFrameCount];
+        return LerpBox(boxes[keyTime.frame0], boxes[keyTime.frame1], keyTime.t);
+    };
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float t;
+    };
+    StackEntry stack[MaxBvhDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    float2 rootT = nodeBox(0).intersect(invD, oxInvD, maxT);
+    if (rootT.x > rootT.y)
+        return;
+
+    while (true)
+    {
+        const BvhNode& node = bvh.nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            for (uint32_t i = 0; i < node.primCount; i++)
+            {
+                if (leafFunc(bvh.primIndices[node.primOffset + i], maxT))
+                    return;
+            }
+        }
+        else
+        {
+            float2 t0 = nodeBox(node.child[0]).intersect(invD, oxInvD, maxT);
+            float2 t1 = nodeBox(node.child[1]).intersect(invD, oxInvD, maxT);
+            bool hit0 = t0.x <= t0.y;
+            bool hit1 = t1.x <= t1.y;
+            if (hit0 && hit1)
+            {
+                uint32_t nearChild = t0.x <= t1.x ? node.child[0] : node.child[1];
+                uint32_t farChild = t0.x <= t1.x ? node.child[1] : node.child[0];
+                stack[stackSize++] = {farChild, fmaxf(t0.x, t1.x)};
+                nodeIndex = nearChild;
+                continue;
+            }
+            if (hit0 || hit1)
+            {
+                nodeIndex = hit0 ? node.child[0] : node.child[1];
+                continue;
+            }
+        }
+
+        do
+        {
+            if (stackSize == 0)
+                return;
+            --stackSize;
+        } while (stack[stackSize].t > maxT);
+        nodeIndex = stack[stackSize].node;
+    }
+}
@@ -0,0 +1,263 @@
+#include "Obb.h"
+#include "Parallel.h"
+#include "SrtFrame.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+// frames of the principal axes and of this many distinct primitive rotations are tried per node
+constexpr uint32_t MaxRotationCandidates = 4;
+// the fit is grown by this much of its extent, the ray is rotated in float and must not slip past a face. The points are
+// projected relative to the center of the node, so their rounding stays well below it wherever the node is.
+constexpr float ObbPadding = 1.0e-5f;
+
+struct ObbFrame
+{
+    float3 axis[3];
+};
+
+// Eigenvectors of the symmetric matrix a by cyclic Jacobi rotations, orthonormal up to rounding
+ObbFrame PrincipalAxes(double a[3][3])
+{
+    double v[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    for (uint32_t sweep = 0; sweep < 16; sweep++)
+    {
+        const double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        if (off < 1.0e-24)
+            break;
+        for (uint32_t p = 0; p < 2; p++)
+        {
+            for (uint32_t q = p + 1; q < 3; q++)
+            {
+                if (a[p][q] == 0.0)
+                    continue;
+                const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                const double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                const double s = t * c;
+                for (uint32_t k = 0; k < 3; k++)
+                {
+                    const double akp = a[k][p];
+                    const double akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for (uint32_t k = 0; k < 3; k++)
+                {
+                    const double apk = a[p][k];
+                    const double aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for (uint32_t k = 0; k < 3; k++)
+                {
+                    const double vkp = v[k][p];
+                    const double vkq = v[k][q];
+                    v[k][p] = c * vkp - s * vkq;
+                    v[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    // Gram-Schmidt on top, the ray transform relies on a rotation
+    ObbFrame frame;
+    float3 x = hiprt::normalize(make_float3(static_cast<float>(v[0][0]), static_cast<float>(v[1][0]), static_cast<float>(v[2][0])));
+    float3 y = make_float3(static_cast<float>(v[0][1]), static_cast<float>(v[1][1]), static_cast<float>(v[2][1]));
+    y = hiprt::normalize(y - hiprt::dot(x, y) * x);
+    frame.axis[0] = x;
+    frame.axis[1] = y;
+    frame.axis[2] = hiprt::cross(x, y);
+    return frame;
+}
+
+ObbFrame RotationFrame(const float4& rotation)
+{
+    ObbFrame frame;
+    frame.axis[0] = RotateQuaternion(rotation, make_float3(1.0f, 0.0f, 0.0f));
+    frame.axis[1] = RotateQuaternion(rotation, make_float3(0.0f, 1.0f, 0.0f));
+    frame.axis[2] = hiprt::cross(frame.axis[0], frame.axis[1]);
+    return frame;
+}
+
+// std::min and std::max on purpose, the fminf of hiprt::min is a libm call without fast math
+hiprt::Aabb FitFrame(const ObbFrame& frame, const float3& center, const std::vector<float4>& points)
+{
+    float3 lo = make_float3(hiprt::FltMax);
+    float3 hi = make_float3(-hiprt::FltMax);
+    for (const float4& point : points)
+    {
+        const float3 p = make_float3(point.x, point.y, point.z) - center;
+        const float3 d = make_float3(hiprt::dot(frame.axis[0], p), hiprt::dot(frame.axis[1], p), hiprt::dot(frame.axis[2], p));
+        lo = make_float3(std::min(lo.x, d.x - point.w), std::min(lo.y, d.y - point.w), std::min(lo.z, d.z - point.w));
+        hi = make_float3(std::max(hi.x, d.x + point.w), std::max(hi.y, d.y + point.w), std::max(hi.z, d.z + point.w));
+    }
+    const float3 pad = make_float3(ObbPadding * std::max(std::max(hi.x - lo.x, hi.y - lo.y), std::max(hi.z - lo.z, 1.0e-6f)));
+    return hiprt::Aabb(lo - pad, hi + pad);
+}
+
+// Smallest surface area box over the candidate frames of the node, false when the world axes win
+bool FitNode(const Bvh& bvh, uint32_t root, const ObbFitInput& input, std::vector<float4>& points, Obb& obb)
+{
+    points.clear();
+    std::vector<float4> rotations;
+    std::vector<uint32_t> stack{root};
+    while (!stack.empty())
+    {
+        const BvhNode& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+        if (!node.IsLeaf())
+        {
+            stack.push_back(node.child[0]);
+            stack.push_back(node.child[1]);
+            continue;
+        }
+        for (uint32_t i = 0; i < node.primCount; i++)
+        {
+            const uint32_t prim = bvh.primIndices[node.primOffset + i];
+            points.insert(points.end(), input.points.begin() + input.offsets[prim], input.points.begin() + input.offsets[prim + 1]);
+            if (rotations.size() < MaxRotationCandidates && !input.rotations.empty())
+            {
+                const float4& q = input.rotations[prim];
+                auto same = [&](const float4& r) { return r.x == q.x && r.y == q.y && r.z == q.z && r.w == q.w; };
+                if (std::find_if(rotations.begin(), rotations.end(), same) == rotations.end())
+                    rotations.push_back(q);
+            }
+        }
+    }
+    if (points.size() < 2)
+        return false;
+
+    double mean[3] = {0.0, 0.0, 0.0};
+    for (const float4& p : points)
+    {
+        mean[0] += p.x;
+        mean[1] += p.y;
+        mean[2] += p.z;
+    }
+    for (double& m : mean) m /= static_cast<double>(points.size());
+    double covariance[3][3] = {};
+    for (const float4& p : points)
+    {
+        const double d[3] = {p.x - mean[0], p.y - mean[1], p.z - mean[2]};
+        for (uint32_t r = 0; r < 3; r++)
+            for (uint32_t c = 0; c < 3; c++) covariance[r][c] += d[r] * d[c];
+    }
+
+    std::vector<ObbFrame> frames{PrincipalAxes(covariance)};
+    for (const float4& rotation : rotations) frames.push_back(RotationFrame(rotation));
+
+    const float3 center = bvh.nodes[root].box.center();
+    float bestArea = bvh.nodes[root].box.area();
+    bool found = false;
+    for (const ObbFrame& frame : frames)
+    {
+        const hiprt::Aabb box = FitFrame(frame, center, points);
+        if (box.area() < bestArea)
+        {
+            bestArea = box.area();
+            obb.axis[0] = frame.axis[0];
+            obb.axis[1] = frame.axis[1];
+            obb.axis[2] = frame.axis[2];
+            obb.center = center;
+            obb.box = box;
+            found = true;
+        }
+    }
+    return found;
+}
+
+} // namespace
+
+bool BuildBvhObbs(const Bvh& bvh, const ObbFitInput& input, uint32_t maxLevels, const BvhBuildOptions& options, BvhObbs& obbs)
+{
+    obbs = BvhObbs{};
+    if (bvh.nodes.empty())
+    {
+        std::cerr << "Bvh obbs: empty bvh\n";
+        return false;
+    }
+    if (maxLevels == 0)
+        return true;
+
+    // subtree costs bottom-up, the expected cost of a ray that hits the box of the node
+    const uint32_t nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> candidates;
+    order.reserve(nodeCount);
+    order.push_back(0);
+    for (uint32_t levelBegin = 0, level = 0; levelBegin < order.size(); level++)
+    {
+        const uint32_t levelEnd = static_cast<uint32_t>(order.size());
+        for (uint32_t i = levelBegin; i < levelEnd; i++)
+        {
+            const BvhNode& node = bvh.nodes[order[i]];
+            if (level < maxLevels)
+                candidates.push_back(order[i]);
+            if (!node.IsLeaf())
+            {
+                order.push_back(node.child[0]);
+                order.push_back(node.child[1]);
+            }
+        }
+        levelBegin = levelEnd;
+    }
+
+    std::vector<float> subtreeCost(nodeCount, 0.0f);
+    for (uint32_t i = nodeCount; i-- > 0;)
+    {
+        const BvhNode& node = bvh.nodes[order[i]];
+        if (node.IsLeaf())
+        {
+            float cost = options.intersectionCost * node.primCount;
+            if (!input.costs.empty())
+            {
+                cost = 0.0f;
+                for (uint32_t p = 0; p < node.primCount; p++) cost += input.costs[bvh.primIndices[node.primOffset + p]];
+            }
+            subtreeCost[order[i]] = cost;
+            continue;
+        }
+        const float area = node.box.area();
+        float cost = options.traversalCost;
+        for (uint32_t c = 0; c < 2; c++)
+        {
+            const float ratio = area > 0.0f ? bvh.nodes[node.child[c]].box.area() / area : 1.0f;
+            cost += ratio * subtreeCost[node.child[c]];
+        }
+        subtreeCost[order[i]] = cost;
+    }
+
+    std::vector<Obb> fitted(candidates.size());
+    std::vector<uint8_t> kept(candidates.size(), 0);
+    std::vector<std::vector<float4>> points(GetWorkerCount());
+    ParallelFor(
+        static_cast<uint32_t>(candidates.size()),
+        [&](uint32_t item, uint32_t worker) {
+            const uint32_t index = candidates[item];
+            const BvhNode& node = bvh.nodes[index];
+            if (!FitNode(bvh, index, input, points[worker], fitted[item]))
+                return;
+
+            const float parentArea = index == 0 ? node.box.area() : bvh.nodes[node.parent].box.area();
+            if (parentArea <= 0.0f)
+                return;
+            const float saved = (node.box.area() - fitted[item].box.area()) / parentArea * subtreeCost[index];
+            kept[item] = saved > (options.orientedBoxCost - 1.0f) * options.traversalCost ? 1 : 0;
+        },
+        GetWorkerCount());
+
+    for (uint32_t i = 0; i < candidates.size(); i++)
+    {
+        if (!kept[i])
+            continue;
+        if (obbs.nodeObbs.empty())
+            obbs.nodeObbs.assign(nodeCount, InvalidNodeIndex);
+        obbs.nodeObbs[candidates[i]] = static_cast<uint32_t>(obbs.obbs.size());
+        obbs.obbs.push_back(fitted[i]);
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Oriented box: box is an Aabb in the frame whose axes are the rows of axis and whose origin is center. The rows are
+// orthonormal, so a ray rotated into the frame keeps its parametrization and the entry and exit distances are those of
+// the world ray.
+struct Obb
+{
+    float3 axis[3];
+    float3 center;
+    hiprt::Aabb box;
+};
+
+// the box is grown by this much of the distance of the rotated origin, the rounding of the rotation grows with it and a
+// ray aimed at a vertex on a face must not slip past where the Aabb test would hit
+constexpr float ObbRayPadding = 1.0e-6f;
+
+// Same result convention as Aabb::intersect, about twice the work: the ray is rotated into the box frame first. The
+// origin is taken relative to the center, so the rounding depends on the distance to the box, not to the world origin.
+// std::max on purpose, the fmaxf of hiprt::max is a libm call without fast math
+inline float2 IntersectObb(const Obb& obb, const hiprtRay& ray, float maxT)
+{
+    const float3 origin = ray.origin - obb.center;
+    const float3 o = make_float3(hiprt::dot(obb.axis[0], origin), hiprt::dot(obb.axis[1], origin), hiprt::dot(obb.axis[2], origin));
+    const float3 d = make_float3(hiprt::dot(obb.axis[0], ray.direction), hiprt::dot(obb.axis[1], ray.direction), hiprt::dot(obb.axis[2], ray.direction));
+    const float3 invD = hiprt::safeInv(d);
+    const float3 pad = make_float3(ObbRayPadding * std::max(std::max(std::abs(o.x), std::abs(o.y)), std::abs(o.z)));
+    return hiprt::Aabb(obb.box.m_min - pad, obb.box.m_max + pad).intersect(invD, -o * invD, maxT);
+}
+
+// Oriented boxes for some nodes of a binary Bvh. They replace the Aabb of the node in the child test of its parent.
+struct BvhObbs
+{
+    // per node index into obbs, InvalidNodeIndex where the node keeps its Aabb. Empty when no node has an oriented box.
+    std::vector<uint32_t> nodeObbs;
+    std::vector<Obb> obbs;
+
+    bool empty() const { return obbs.empty(); }
+};
+
+// Primitive support of the fit: the points of primitive p are points[offsets[p], offsets[p + 1]), each grown by the
+// radius in w (0 for triangle vertices, the radius for spheres). rotations, when not empty, holds a unit quaternion per
+// primitive that is tried as box frame for the nodes above it, the rotation of an instance fits it exactly.
+struct ObbFitInput
+{
+    std::vector<float4> points;
+    std::vector<uint32_t> offsets;
+    // replaces BvhBuildOptions::intersectionCost per primitive when not empty, an instance costs its BLAS traversal
+    std::vector<float> costs;
+    std::vector<float4> rotations;
+};
+
+// Fits oriented boxes to the nodes of the top maxLevels levels below the root (the root is level 0) and keeps those for
+// which the SAH says the tighter box pays for the dearer test: the parent saves (area(aabb) - area(obb)) / area(parent)
+// of the subtree cost and pays options.orientedBoxCost - 1 traversal steps for every test. The frames tried per node are
+// the world axes, the principal axes of its points and the rotations of a few of its primitives.
+bool BuildBvhObbs(const Bvh& bvh, const ObbFitInput& input, uint32_t maxLevels, const BvhBuildOptions& options, BvhObbs& obbs);
+
+// Stands in for a Bvh in the traversal templates, the nodes with an oriented box are tested against it
+struct ObbBvhView
+{
+    const std::vector<BvhNode>& nodes;
+    const std::vector<uint32_t>& primIndices;
+    const BvhObbs& obbs;
+};
+
+inline float2 IntersectBvhNode(const ObbBvhView& bvh, uint32_t index, const hiprtRay& ray, const float3& invD, const float3& oxInvD, float maxT)
+{
+    const uint32_t obb = bvh.obbs.nodeObbs[index];
+    if (obb != InvalidNodeIndex)
+        return IntersectObb(bvh.obbs.obbs[obb], ray, maxT);
+    return bvh.nodes[index].box.intersect(invD, oxInvD, maxT);
+}
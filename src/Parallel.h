@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline uint32_t GetWorkerCount()
+{
+    uint32_t count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+// Set while a thread works for a ParallelFor or a TaskPool. Parallel loops nested in one run inline on the calling
+// worker, the outer loop already keeps every core busy (a batch of BVH builds that each bin in parallel).
+inline thread_local bool InParallelWorker = false;
+
+// Calls func(itemIndex, workerIndex) for every item in [0, count).
+// Items are handed out one by one through an atomic counter, so uneven items (image tiles, big BVH nodes) balance themselves.
+template<typename Func>
+void ParallelFor(uint32_t count, Func&& func, uint32_t workerCount = 0)
+{
+    if (workerCount == 0)
+        workerCount = GetWorkerCount();
+    workerCount = std::min(workerCount, count);
+
+    if (workerCount <= 1 || InParallelWorker)
+    {
+        for (uint32_t i = 0; i < count; i++) func(i, 0u);
+        return;
+    }
+
+    std::atomic<uint32_t> next{0};
+    auto worker = [&](uint32_t workerIndex) {
+        InParallelWorker = true;
+        for (uint32_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) func(i, workerIndex);
+        InParallelWorker = false;
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount - 1);
+    for (uint32_t w = 1; w < workerCount; w++) workers.emplace_back(worker, w);
+    worker(0);
+    for (auto& t : workers) t.join();
+}
+
+// Work stealing pool for recursive tasks. Every worker runs the newest task of its own deque and steals the oldest one
+// of another worker when its deque runs dry, so big subtasks spread out early while the small ones stay local.
+// A task gets the index of the worker it runs on and may Push more tasks for it.
+class TaskPool
+{
+public:
+    using Task = std::function<void(uint32_t)>;
+
+    explicit TaskPool(uint32_t workerCount = 0) : m_queues(workerCount > 0 ? workerCount : GetWorkerCount())
+    {
+        for (auto& queue : m_queues) queue = std::make_unique<Queue>();
+    }
+
+    uint32_t WorkerCount() const { return static_cast<uint32_t>(m_queues.size()); }
+
+    // worker is the index passed to the running task, or any index to seed the pool before Run
+    void Push(uint32_t worker, Task task)
+    {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        Queue& queue = *m_queues[worker % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    // returns when every task, including the ones pushed while running, has finished. Inside another parallel loop
+    // the calling worker runs all of them.
+    void Run()
+    {
+        if (InParallelWorker)
+        {
+            Work(0);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        workers.reserve(m_queues.size() - 1);
+        for (uint32_t w = 1; w < m_queues.size(); w++) workers.emplace_back([this, w] { Work(w); });
+        Work(0);
+        for (auto& t : workers) t.join();
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool Pop(uint32_t worker, Task& task)
+    {
+        const uint32_t count = static_cast<uint32_t>(m_queues.size());
+        for (uint32_t i = 0; i < count; i++)
+        {
+            Queue& queue = *m_queues[(worker + i) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void Work(uint32_t worker)
+    {
+        const bool nested = InParallelWorker;
+        InParallelWorker = true;
+        Task task;
+        while (m_pending.load(std::memory_order_acquire) > 0)
+        {
+            if (!Pop(worker, task))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            task(worker);
+            task = nullptr;
+            m_pending.fetch_sub(1, std::memory_order_release);
+        }
+        InParallelWorker = nested;
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::atomic<uint32_t> m_pending{0};
+};
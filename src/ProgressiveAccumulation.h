@@ -0,0 +1,37 @@
+#pragma once
+
+#include "../kernels/shared.h"
+
+#include <cstdint>
+
+// Sample index of a progressive render that adds one sample per pixel every frame. The accumulation restarts when the
+// camera or the AO radius differ from the last frame, or when sceneVersion was bumped (rebuilt or refitted geometry).
+struct ProgressiveAccumulation
+{
+    // index of the sample the next frame renders, 0 tells the kernel to overwrite the accumulation buffer
+    uint32_t Advance(const Camera& camera, float aoRadius, uint32_t sceneVersion)
+    {
+        const bool sameView = camera.m_rotation.x == m_camera.m_rotation.x && camera.m_rotation.y == m_camera.m_rotation.y &&
+                              camera.m_rotation.z == m_camera.m_rotation.z && camera.m_rotation.w == m_camera.m_rotation.w &&
+                              camera.m_translation.x == m_camera.m_translation.x && camera.m_translation.y == m_camera.m_translation.y &&
+                              camera.m_translation.z == m_camera.m_translation.z && camera.m_fov == m_camera.m_fov;
+        if (!m_started || !sameView || aoRadius != m_aoRadius || sceneVersion != m_sceneVersion)
+        {
+            m_started = true;
+            m_camera = camera;
+            m_aoRadius = aoRadius;
+            m_sceneVersion = sceneVersion;
+            m_sampleCount = 0;
+        }
+        return m_sampleCount++;
+    }
+
+    uint32_t SampleCount() const { return m_sampleCount; }
+
+private:
+    bool m_started{false};
+    Camera m_camera{};
+    float m_aoRadius{0.0f};
+    uint32_t m_sceneVersion{0};
+    uint32_t m_sampleCount{0};
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Stable LSD radix sort of (key, value) pairs, 8 bits per pass. Only the low keyBits bits of the keys are sorted.
+// Every pass builds per chunk histograms in parallel, scans them digit major and scatters each chunk in parallel.
+// keysTmp and valuesTmp are the ping-pong buffers, the caller keeps them to reuse their capacity. The sorted pairs end up
+// in keys and values, which keep their own storage.
+template<typename Key>
+void RadixSortPairs(std::vector<Key>& keys, std::vector<uint32_t>& values, uint32_t keyBits, std::vector<Key>& keysTmp, std::vector<uint32_t>& valuesTmp)
+{
+    constexpr uint32_t RadixBits = 8;
+    constexpr uint32_t RadixSize = 1u << RadixBits;
+    constexpr uint32_t ChunkSize = 16384;
+
+    const uint32_t count = static_cast<uint32_t>(keys.size());
+    const uint32_t chunkCount = (count + ChunkSize - 1) / ChunkSize;
+    const uint32_t passCount = (keyBits + RadixBits - 1) / RadixBits;
+
+    keysTmp.resize(count);
+    valuesTmp.resize(count);
+    std::vector<uint32_t> offsets(chunkCount * RadixSize);
+
+    for (uint32_t pass = 0; pass < passCount; pass++)
+    {
+        const uint32_t shift = pass * RadixBits;
+
+        ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t) {
+            uint32_t* histogram = &offsets[chunk * RadixSize];
+            std::fill(histogram, histogram + RadixSize, 0u);
+            const uint32_t end = std::min(count, (chunk + 1) * ChunkSize);
+            for (uint32_t i = chunk * ChunkSize; i < end; i++) histogram[(keys[i] >> shift) & (RadixSize - 1)]++;
+        });
+
+        uint32_t sum = 0;
+        for (uint32_t digit = 0; digit < RadixSize; digit++)
+        {
+            for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+            {
+                uint32_t& offset = offsets[chunk * RadixSize + digit];
+                uint32_t c = offset;
+                offset = sum;
+                sum += c;
+            }
+        }
+
+        ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t) {
+            uint32_t* offset = &offsets[chunk * RadixSize];
+            const uint32_t end = std::min(count, (chunk + 1) * ChunkSize);
+            for (uint32_t i = chunk * ChunkSize; i < end; i++)
+            {
+                uint32_t dst = offset[(keys[i] >> shift) & (RadixSize - 1)]++;
+                keysTmp[dst] = keys[i];
+                valuesTmp[dst] = values[i];
+            }
+        });
+
+        keys.swap(keysTmp);
+        values.swap(valuesTmp);
+    }
+
+    // after an odd pass count the result sits in the storage of the temporaries
+    if (passCount % 2 == 1)
+    {
+        keys.swap(keysTmp);
+        values.swap(valuesTmp);
+        std::copy(keysTmp.begin(), keysTmp.begin() + count, keys.begin());
+        std::copy(valuesTmp.begin(), valuesTmp.begin() + count, values.begin());
+    }
+}
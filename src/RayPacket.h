@@ -0,0 +1,183 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Aabb.h"
+
+#include <bit>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#    include <immintrin.h>
+#endif
+
+// 8x8 pixel tile, one bit per ray in a uint64_t mask
+constexpr uint32_t RayPacketWidth = 8;
+constexpr uint32_t RayPacketSize = RayPacketWidth * RayPacketWidth;
+// rays are tested in groups of eight, one AVX2 register per component
+constexpr uint32_t RayGroupSize = 8;
+
+// Rays of a tile in SoA layout. maxT shrinks as closer hits are found.
+struct alignas(32) RayPacket
+{
+    float ox[RayPacketSize];
+    float oy[RayPacketSize];
+    float oz[RayPacketSize];
+    float dx[RayPacketSize];
+    float dy[RayPacketSize];
+    float dz[RayPacketSize];
+    float invDx[RayPacketSize];
+    float invDy[RayPacketSize];
+    float invDz[RayPacketSize];
+    float oxInvDx[RayPacketSize];
+    float oxInvDy[RayPacketSize];
+    float oxInvDz[RayPacketSize];
+    float minT[RayPacketSize];
+    float maxT[RayPacketSize];
+};
+
+inline void SetPacketRay(RayPacket& packet, uint32_t i, const hiprtRay& ray)
+{
+    const float3 invD = hiprt::safeInv(ray.direction);
+    packet.ox[i] = ray.origin.x;
+    packet.oy[i] = ray.origin.y;
+    packet.oz[i] = ray.origin.z;
+    packet.dx[i] = ray.direction.x;
+    packet.dy[i] = ray.direction.y;
+    packet.dz[i] = ray.direction.z;
+    packet.invDx[i] = invD.x;
+    packet.invDy[i] = invD.y;
+    packet.invDz[i] = invD.z;
+    packet.oxInvDx[i] = -ray.origin.x * invD.x;
+    packet.oxInvDy[i] = -ray.origin.y * invD.y;
+    packet.oxInvDz[i] = -ray.origin.z * invD.z;
+    packet.minT[i] = ray.minT;
+    packet.maxT[i] = ray.maxT;
+}
+
+inline hiprtRay GetPacketRay(const RayPacket& packet, uint32_t i)
+{
+    hiprtRay ray;
+    ray.origin = make_float3(packet.ox[i], packet.oy[i], packet.oz[i]);
+    ray.direction = make_float3(packet.dx[i], packet.dy[i], packet.dz[i]);
+    ray.minT = packet.minT[i];
+    ray.maxT = packet.maxT[i];
+    return ray;
+}
+
+// Slab test of the rays [group * 8, group * 8 + 8) against one box, same expression as Aabb::intersect.
+// Returns a bit per hit ray of the group.
+inline uint32_t IntersectBoxPacket(const RayPacket& packet, uint32_t group, const hiprt::Aabb& box)
+{
+    const uint32_t first = group * RayGroupSize;
+#if defined(__AVX2__)
+    auto slab = [](float plane, const float* invD, const float* oxInvD) {
+#    if defined(__FMA__) || defined(_MSC_VER)
+        return _mm256_fmadd_ps(_mm256_set1_ps(plane), _mm256_load_ps(invD), _mm256_load_ps(oxInvD));
+#    else
+        return _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane), _mm256_load_ps(invD)), _mm256_load_ps(oxInvD));
+#    endif
+    };
+
+    const __m256 x0 = slab(box.m_min.x, packet.invDx + first, packet.oxInvDx + first);
+    const __m256 x1 = slab(box.m_max.x, packet.invDx + first, packet.oxInvDx + first);
+    const __m256 y0 = slab(box.m_min.y, packet.invDy + first, packet.oxInvDy + first);
+    const __m256 y1 = slab(box.m_max.y, packet.invDy + first, packet.oxInvDy + first);
+    const __m256 z0 = slab(box.m_min.z, packet.invDz + first, packet.oxInvDz + first);
+    const __m256 z1 = slab(box.m_max.z, packet.invDz + first, packet.oxInvDz + first);
+
+    const __m256 t0 = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_max_ps(_mm256_min_ps(z0, z1), _mm256_setzero_ps()));
+    const __m256 t1 = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_min_ps(_mm256_max_ps(z0, z1), _mm256_load_ps(packet.maxT + first)));
+    return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)));
+#else
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < RayGroupSize; i++)
+    {
+        const uint32_t r = first + i;
+        const float3 invD = make_float3(packet.invDx[r], packet.invDy[r], packet.invDz[r]);
+        const float3 oxInvD = make_float3(packet.oxInvDx[r], packet.oxInvDy[r], packet.oxInvDz[r]);
+        const float2 t = box.intersect(invD, oxInvD, packet.maxT[r]);
+        if (t.x <= t.y)
+            hits |= 1u << i;
+    }
+    return hits;
+#endif
+}
+
+// Moller-Trumbore of the rays of a group against one triangle, same tests as IntersectTriangle.
+// Returns a bit per hit ray of the group within [minT, maxT], t and the barycentrics are written for all eight rays.
+inline uint32_t IntersectTrianglePacket(const RayPacket& packet, uint32_t group, const float3& p0, const float3& e1, const float3& e2, float* t, float* u, float* v)
+{
+    const uint32_t first = group * RayGroupSize;
+#if defined(__AVX2__)
+#    if defined(__FMA__) || defined(_MSC_VER)
+    auto mul_add = [](__m256 a, __m256 b, __m256 c) { return _mm256_fmadd_ps(a, b, c); };
+    auto mul_sub = [](__m256 a, __m256 b, __m256 c) { return _mm256_fmsub_ps(a, b, c); };
+#    else
+    auto mul_add = [](__m256 a, __m256 b, __m256 c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); };
+    auto mul_sub = [](__m256 a, __m256 b, __m256 c) { return _mm256_sub_ps(_mm256_mul_ps(a, b), c); };
+#    endif
+    const __m256 dx = _mm256_load_ps(packet.dx + first);
+    const __m256 dy = _mm256_load_ps(packet.dy + first);
+    const __m256 dz = _mm256_load_ps(packet.dz + first);
+    const __m256 e1x = _mm256_set1_ps(e1.x);
+    const __m256 e1y = _mm256_set1_ps(e1.y);
+    const __m256 e1z = _mm256_set1_ps(e1.z);
+    const __m256 e2x = _mm256_set1_ps(e2.x);
+    const __m256 e2y = _mm256_set1_ps(e2.y);
+    const __m256 e2z = _mm256_set1_ps(e2.z);
+
+    // s1 = cross(d, e2)
+    const __m256 s1x = mul_sub(dy, e2z, _mm256_mul_ps(dz, e2y));
+    const __m256 s1y = mul_sub(dz, e2x, _mm256_mul_ps(dx, e2z));
+    const __m256 s1z = mul_sub(dx, e2y, _mm256_mul_ps(dy, e2x));
+    const __m256 denom = mul_add(s1x, e1x, mul_add(s1y, e1y, _mm256_mul_ps(s1z, e1z)));
+    const __m256 invd = _mm256_div_ps(_mm256_set1_ps(1.0f), denom);
+
+    const __m256 sx = _mm256_sub_ps(_mm256_load_ps(packet.ox + first), _mm256_set1_ps(p0.x));
+    const __m256 sy = _mm256_sub_ps(_mm256_load_ps(packet.oy + first), _mm256_set1_ps(p0.y));
+    const __m256 sz = _mm256_sub_ps(_mm256_load_ps(packet.oz + first), _mm256_set1_ps(p0.z));
+    const __m256 b1 = _mm256_mul_ps(mul_add(sx, s1x, mul_add(sy, s1y, _mm256_mul_ps(sz, s1z))), invd);
+
+    // s2 = cross(s, e1)
+    const __m256 s2x = mul_sub(sy, e1z, _mm256_mul_ps(sz, e1y));
+    const __m256 s2y = mul_sub(sz, e1x, _mm256_mul_ps(sx, e1z));
+    const __m256 s2z = mul_sub(sx, e1y, _mm256_mul_ps(sy, e1x));
+    const __m256 b2 = _mm256_mul_ps(mul_add(dx, s2x, mul_add(dy, s2y, _mm256_mul_ps(dz, s2z))), invd);
+    const __m256 t8 = _mm256_mul_ps(mul_add(e2x, s2x, mul_add(e2y, s2y, _mm256_mul_ps(e2z, s2z))), invd);
+
+    // ordered compares, a zero denominator gives infinities or NaNs that fail them
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 valid = _mm256_cmp_ps(denom, zero, _CMP_NEQ_OQ);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(b1, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(b2, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(b1, b2), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t8, _mm256_load_ps(packet.minT + first), _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t8, _mm256_load_ps(packet.maxT + first), _CMP_LE_OQ));
+
+    _mm256_storeu_ps(t, t8);
+    _mm256_storeu_ps(u, b1);
+    _mm256_storeu_ps(v, b2);
+    return static_cast<uint32_t>(_mm256_movemask_ps(valid));
+#else
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < RayGroupSize; i++)
+    {
+        const uint32_t r = first + i;
+        const float3 d = make_float3(packet.dx[r], packet.dy[r], packet.dz[r]);
+        const float3 s1 = hiprt::cross(d, e2);
+        const float denom = hiprt::dot(s1, e1);
+        if (denom == 0.f)
+            continue;
+
+        const float invd = 1.0f / denom;
+        const float3 s = make_float3(packet.ox[r], packet.oy[r], packet.oz[r]) - p0;
+        const float3 s2 = hiprt::cross(s, e1);
+        u[i] = hiprt::dot(s, s1) * invd;
+        v[i] = hiprt::dot(d, s2) * invd;
+        t[i] = hiprt::dot(e2, s2) * invd;
+        if (u[i] >= 0.f && v[i] >= 0.f && u[i] + v[i] <= 1.f && t[i] >= packet.minT[r] && t[i] <= packet.maxT[r])
+            hits |= 1u << i;
+    }
+    return hits;
+#endif
+}
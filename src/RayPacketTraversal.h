@@ -0,0 +1,178 @@
+#pragma once
+
+#include "BvhTraversal.h"
+#include "RayPacket.h"
+
+#include <algorithm>
+#include <bit>
+
+// a subtree that fewer rays reach than this is finished with single ray traversals
+constexpr uint32_t PacketMinActiveRays = 8;
+// relative slack of the interval test, covers the rounding differences to the per ray slab test
+constexpr float PacketIntervalEpsilon = 1.0e-5f;
+
+// Bounds of the origins, inverse directions and maxT over the rays of a packet
+struct PacketInterval
+{
+    float3 originMin;
+    float3 originMax;
+    float3 invDMin;
+    float3 invDMax;
+    float maxTMin;
+    float maxTMax;
+};
+
+inline float2 IntervalProduct(float aMin, float aMax, float bMin, float bMax)
+{
+    const float p0 = aMin * bMin;
+    const float p1 = aMin * bMax;
+    const float p2 = aMax * bMin;
+    const float p3 = aMax * bMax;
+    return make_float2(std::min(std::min(p0, p1), std::min(p2, p3)), std::max(std::max(p0, p1), std::max(p2, p3)));
+}
+
+// Interval arithmetic slab test, the near plane of an axis is the same for all rays because their direction signs
+// agree. Returns false when no ray of the packet can hit the box, allHit is set when every ray hits it for sure.
+inline bool IntersectPacketInterval(const PacketInterval& interval, const float3& directionSign, const hiprt::Aabb& box, bool& allHit)
+{
+    float tNearMin = 0.0f;
+    float tNearMax = 0.0f;
+    float tFarMin = interval.maxTMin;
+    float tFarMax = interval.maxTMax;
+    auto axis = [&](float boxMin, float boxMax, float sign, float originMin, float originMax, float invDMin, float invDMax) {
+        const float nearPlane = sign > 0.0f ? boxMin : boxMax;
+        const float farPlane = sign > 0.0f ? boxMax : boxMin;
+        const float2 tNear = IntervalProduct(nearPlane - originMax, nearPlane - originMin, invDMin, invDMax);
+        const float2 tFar = IntervalProduct(farPlane - originMax, farPlane - originMin, invDMin, invDMax);
+        tNearMin = std::max(tNearMin, tNear.x);
+        tNearMax = std::max(tNearMax, tNear.y);
+        tFarMin = std::min(tFarMin, tFar.x);
+        tFarMax = std::min(tFarMax, tFar.y);
+    };
+    axis(box.m_min.x, box.m_max.x, directionSign.x, interval.originMin.x, interval.originMax.x, interval.invDMin.x, interval.invDMax.x);
+    axis(box.m_min.y, box.m_max.y, directionSign.y, interval.originMin.y, interval.originMax.y, interval.invDMin.y, interval.invDMax.y);
+    axis(box.m_min.z, box.m_max.z, directionSign.z, interval.originMin.z, interval.originMax.z, interval.invDMin.z, interval.invDMax.z);
+
+    allHit = tNearMax * (1.0f + PacketIntervalEpsilon) < tFarMin * (1.0f - PacketIntervalEpsilon);
+    return tNearMin * (1.0f - PacketIntervalEpsilon) <= tFarMax * (1.0f + PacketIntervalEpsilon);
+}
+
+// Packet traversal of a binary Bvh for coherent rays (primary rays of an 8x8 tile). A node is first tested for the
+// whole packet with interval bounds, which either culls it or accepts it for all rays. Otherwise the rays still active
+// are slab tested eight at a time and only those go on into the subtree. Packets whose direction signs disagree, and subtrees reached by fewer than PacketMinActiveRays
+// rays, continue as single rays. leafFunc(primOffset, primCount, rayMask) intersects the rays in rayMask with the
+// primitives of a leaf and shrinks their packet.maxT.
+template<typename LeafFunc>
+void TraverseBvhPacket(const Bvh& bvh, RayPacket& packet, uint64_t activeMask, LeafFunc&& leafFunc)
+{
+    if (bvh.nodes.empty() || activeMask == 0)
+        return;
+
+    auto traceSingle = [&](uint64_t mask, uint32_t nodeIndex) {
+        for (; mask != 0; mask &= mask - 1)
+        {
+            const uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+            const uint64_t rayMask = uint64_t{1} << i;
+            // the leaf function shrinks packet.maxT[i], which is the maxT of this traversal
+            TraverseBvhLeaves(
+                bvh,
+                GetPacketRay(packet, i),
+                packet.maxT[i],
+                [&](uint32_t primOffset, uint32_t primCount, float&) {
+                    leafFunc(primOffset, primCount, rayMask);
+                    return false;
+                },
+                nodeIndex);
+        }
+    };
+
+    const uint32_t first = static_cast<uint32_t>(std::countr_zero(activeMask));
+    const float3 directionSign = make_float3(packet.invDx[first] >= 0.0f ? 1.0f : -1.0f, packet.invDy[first] >= 0.0f ? 1.0f : -1.0f, packet.invDz[first] >= 0.0f ? 1.0f : -1.0f);
+    const float3 direction = make_float3(packet.dx[first], packet.dy[first], packet.dz[first]);
+
+    // std::min and std::max on purpose, the fminf of hiprt::min is a libm call without fast math
+    PacketInterval interval;
+    interval.originMin = interval.originMax = make_float3(packet.ox[first], packet.oy[first], packet.oz[first]);
+    interval.invDMin = interval.invDMax = make_float3(packet.invDx[first], packet.invDy[first], packet.invDz[first]);
+    for (uint64_t mask = activeMask; mask != 0; mask &= mask - 1)
+    {
+        const uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+        if (packet.invDx[i] * directionSign.x < 0.0f || packet.invDy[i] * directionSign.y < 0.0f || packet.invDz[i] * directionSign.z < 0.0f)
+        {
+            traceSingle(activeMask, 0);
+            return;
+        }
+        interval.originMin = make_float3(std::min(interval.originMin.x, packet.ox[i]), std::min(interval.originMin.y, packet.oy[i]), std::min(interval.originMin.z, packet.oz[i]));
+        interval.originMax = make_float3(std::max(interval.originMax.x, packet.ox[i]), std::max(interval.originMax.y, packet.oy[i]), std::max(interval.originMax.z, packet.oz[i]));
+        interval.invDMin = make_float3(std::min(interval.invDMin.x, packet.invDx[i]), std::min(interval.invDMin.y, packet.invDy[i]), std::min(interval.invDMin.z, packet.invDz[i]));
+        interval.invDMax = make_float3(std::max(interval.invDMax.x, packet.invDx[i]), std::max(interval.invDMax.y, packet.invDy[i]), std::max(interval.invDMax.z, packet.invDz[i]));
+    }
+
+    auto updateMaxT = [&](uint64_t mask) {
+        interval.maxTMin = packet.maxT[std::countr_zero(mask)];
+        interval.maxTMax = interval.maxTMin;
+        for (; mask != 0; mask &= mask - 1)
+        {
+            interval.maxTMin = std::min(interval.maxTMin, packet.maxT[std::countr_zero(mask)]);
+            interval.maxTMax = std::max(interval.maxTMax, packet.maxT[std::countr_zero(mask)]);
+        }
+    };
+    updateMaxT(activeMask);
+
+    auto intersectNode = [&](const hiprt::Aabb& box, uint64_t mask) {
+        bool allHit = false;
+        if (!IntersectPacketInterval(interval, directionSign, box, allHit))
+            return uint64_t{0};
+        if (allHit)
+            return mask;
+
+        uint64_t hits = 0;
+        for (uint32_t group = 0; group < RayPacketSize / RayGroupSize; group++)
+        {
+            const uint64_t groupMask = (mask >> (group * RayGroupSize)) & 0xff;
+            if (groupMask != 0)
+                hits |= static_cast<uint64_t>(IntersectBoxPacket(packet, group, box) & groupMask) << (group * RayGroupSize);
+        }
+        return hits;
+    };
+
+    struct StackEntry
+    {
+        uint32_t node;
+        uint64_t mask;
+    };
+    StackEntry stack[MaxBvhDepth];
+    uint32_t stackSize = 0;
+    StackEntry current{0, activeMask};
+
+    while (true)
+    {
+        const BvhNode& node = bvh.nodes[current.node];
+        const uint64_t mask = intersectNode(node.box, current.mask);
+        if (mask != 0)
+        {
+            if (static_cast<uint32_t>(std::popcount(mask)) < PacketMinActiveRays)
+            {
+                traceSingle(mask, current.node);
+            }
+            else if (node.IsLeaf())
+            {
+                leafFunc(node.primOffset, node.primCount, mask);
+                updateMaxT(activeMask);
+            }
+            else
+            {
+                // the child whose center lies first along the packet direction is visited first
+                const float3 delta = bvh.nodes[node.child[1]].box.center() - bvh.nodes[node.child[0]].box.center();
+                const bool firstIsNear = hiprt::dot(delta, direction) >= 0.0f;
+                stack[stackSize++] = {firstIsNear ? node.child[1] : node.child[0], mask};
+                current = {firstIsNear ? node.child[0] : node.child[1], mask};
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            return;
+        current = stack[--stackSize];
+    }
+}
@@ -0,0 +1,47 @@
+#include "RayStream.h"
+#include "Morton.h"
+#include "RadixSort.h"
+
+#include <algorithm>
+#include <numeric>
+
+void ClearRayStream(RayStream& stream)
+{
+    stream.rays.clear();
+    stream.owners.clear();
+    stream.order.clear();
+    stream.keys.clear();
+}
+
+void SortRayStream(RayStream& stream)
+{
+    const uint32_t count = static_cast<uint32_t>(stream.rays.size());
+    if (count == 0)
+        return;
+
+    // the origins are quantized in their own bounds, a tile covers a small part of the scene.
+    // std::min and std::max on purpose, the fminf of hiprt::min is a libm call without fast math
+    float3 originMin = stream.rays[0].origin;
+    float3 originMax = originMin;
+    for (const hiprtRay& ray : stream.rays)
+    {
+        originMin = make_float3(std::min(originMin.x, ray.origin.x), std::min(originMin.y, ray.origin.y), std::min(originMin.z, ray.origin.z));
+        originMax = make_float3(std::max(originMax.x, ray.origin.x), std::max(originMax.y, ray.origin.y), std::max(originMax.z, ray.origin.z));
+    }
+    const float3 extent = originMax - originMin;
+    const float maxExtent = std::max(std::max(extent.x, extent.y), extent.z);
+    const float scale = maxExtent > 0.0f ? 1.0f / maxExtent : 0.0f;
+
+    stream.keys.resize(count);
+    stream.order.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const hiprtRay& ray = stream.rays[i];
+        const uint32_t morton = MortonCode<uint32_t>((ray.origin - originMin) * scale) >> (30 - RayStreamMortonBits);
+        stream.keys[i] = (DirectionOctant(ray.direction) << RayStreamMortonBits) | morton;
+    }
+    std::iota(stream.order.begin(), stream.order.end(), 0u);
+
+    // a tile is a single chunk of the radix sort, it runs on the calling worker
+    RadixSortPairs(stream.keys, stream.order, RayStreamMortonBits + 3, stream.keysTmp, stream.orderTmp);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../kernels/shared.h"
+
+#include <cstdint>
+#include <vector>
+
+// Secondary rays of a tile gathered before they are traced. SortRayStream orders them by direction octant and then by
+// the Morton code of their origin, so rays that follow each other start close together and point the same way.
+struct RayStream
+{
+    std::vector<hiprtRay> rays;
+    // the pixel of the tile a ray belongs to
+    std::vector<uint32_t> owners;
+    // rays[order[i]] is the i-th ray in sorted order, keys[i] is its octant (top bits) and Morton code
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> keys;
+    // buffers of the sort, kept with the stream so a tile does not allocate them again
+    std::vector<uint32_t> orderTmp;
+    std::vector<uint32_t> keysTmp;
+};
+
+// 9 bits per axis, the octant takes the three bits above
+constexpr uint32_t RayStreamMortonBits = 27;
+
+// bit per negative direction component
+inline uint32_t DirectionOctant(const float3& direction)
+{
+    return (direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) | (direction.z < 0.0f ? 4u : 0u);
+}
+
+void ClearRayStream(RayStream& stream);
+
+void SortRayStream(RayStream& stream);
@@ -6,6 +6,8 @@ enum class CASE_TYPE : uint32_t
     GEOMETRY_HIT_DISTANCE = 0,
     SCENE_HIT_DISTANCE,
     SCENE_AMBIENT_OCCLUSION,
+    // the vertices of the mesh as analytic spheres, custom geometry of the AABB_LIST path
+    SCENE_AMBIENT_OCCLUSION_SPHERES,
     GEOMETRY_DEBUG,
     GEOMETRY_DEBUG_WITH_CAMERA,
     SCENE_TRANSFORMATION_MB_SAMPLING,
@@ -231,16 +233,9 @@ bool Render<CASE_TYPE::GEOMETRY_HIT_DISTANCE>(hiprtContext context, hipStream_t
     return true;
 }
 
-template<>
-bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(hiprtContext rtContext, hipStream_t stream, const fs::path& meshPath, const fs::path& mtlPath, const fs::path output)
+// AO of meshes and sphere lists, every geometry is one instance with an identity transform
+bool RenderAoScene(hiprtContext rtContext, hipStream_t stream, std::vector<TriangleMesh>& meshes, const fs::path output)
 {
-    std::vector<TriangleMesh> meshes;
-
-    if (ReadObjMesh(meshPath, mtlPath, meshes) == false)
-    {
-        return false;
-    }
-
     std::vector<hiprtGeometryBuildInput> geometryBuildInputs;
     BuildMeshes(meshes);
     CollectGeometryBuildInputs(geometryBuildInputs, meshes);
@@ -268,6 +263,7 @@ bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(hiprtContext rtContext, hipStrea
         data.nDeformations = mesh.deformation_count;
         data.triangles = reinterpret_cast<uint3*>(mesh.mesh.triangleIndices);
         data.vertices = reinterpret_cast<float3*>(mesh.mesh.vertices);
+        data.spheres = reinterpret_cast<float4*>(mesh.device_spheres);
     }
 
     hiprtDevicePtr deviceGeometryData{nullptr};
@@ -278,8 +274,14 @@ bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(hiprtContext rtContext, hipStrea
     funcDataSet.intersectFuncData = (void*) deviceGeometryData;
     funcDataSet.filterFuncData = (void*) deviceGeometryData;
 
+    // sphere lists are intersected through the table, one ray type
+    constexpr uint32_t numGeometryTypes = static_cast<uint32_t>(GEOMETRY_TYPE::GEOMETRY_TYPE_COUNT);
     hiprtFuncTable funcTable;
-    hiprtError result = hiprtCreateFuncTable(rtContext, 1, 1, funcTable);
+    HIP_ASSERT(hiprtSuccess == hiprtCreateFuncTable(rtContext, numGeometryTypes, 1, funcTable), "function table");
+    for (uint32_t geometryType = 0; geometryType < numGeometryTypes; geometryType++)
+    {
+        HIP_ASSERT(hiprtSuccess == hiprtSetFuncTable(rtContext, funcTable, geometryType, 0, funcDataSet), "Function table set");
+    }
 
     // Camera
     Camera camera;
@@ -296,6 +298,8 @@ bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(hiprtContext rtContext, hipStrea
     constexpr int blockHeight = 8;
     constexpr int blockSize = blockWidth * blockHeight;
     float aoRadius = 1.4f;
+    // 512 samples per pixel, errorThreshold above 0 lets converged pixels stop early and leave theirs to the noisy ones of their block
+    AoSampling sampling;
 
     hiprtDevicePtr outputImage;
     HIP_ASSERT(hipMalloc(&outputImage, width * height * 4) == hipSuccess, "malloc");
@@ -319,7 +323,7 @@ bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(hiprtContext rtContext, hipStrea
     int maxDynamicSharedSizeBytes{0};
     int sharedSizeBytes{0};
 
-    void* kernel_args[] = {&scene, &outputImage, &resolution, &globalStackBuffer, &camera, &aoRadius, &funcTable};
+    void* kernel_args[] = {&scene, &outputImage, &resolution, &globalStackBuffer, &camera, &aoRadius, &funcTable, &sampling};
     launchKernel(kernel, width, height, kernel_args, stream, blockWidth, blockHeight);
     HIP_ASSERT(hipStreamSynchronize(stream) == hipSuccess, "stream sync");
 
@@ -340,6 +344,49 @@ bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(hiprtContext rtContext, hipStrea
     return true;
 }
 
+// point cloud of the mesh vertices as analytic spheres, sized relative to the extent of each mesh
+bool CreateVertexSphereLists(std::vector<TriangleMesh>& meshes)
+{
+    constexpr float SphereRadiusScale = 0.005f;
+    std::vector<TriangleMesh> sphereLists(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        if (meshes[i].vertices.empty())
+            return false;
+        const BoundingBox3D bounds = compute_axis_aligned_bounding_box(meshes[i].vertices);
+        const float3 extent = bounds.max_point - bounds.min_point;
+        CreateVertexSpheres(meshes[i], SphereRadiusScale * sqrtf(hiprt::dot(extent, extent)), sphereLists[i]);
+    }
+    meshes.swap(sphereLists);
+    return true;
+}
+
+template<>
+bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(hiprtContext rtContext, hipStream_t stream, const fs::path& meshPath, const fs::path& mtlPath, const fs::path output)
+{
+    std::vector<TriangleMesh> meshes;
+
+    if (ReadObjMesh(meshPath, mtlPath, meshes) == false)
+    {
+        return false;
+    }
+
+    return RenderAoScene(rtContext, stream, meshes, output);
+}
+
+template<>
+bool Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION_SPHERES>(hiprtContext rtContext, hipStream_t stream, const fs::path& meshPath, const fs::path& mtlPath, const fs::path output)
+{
+    std::vector<TriangleMesh> meshes;
+
+    if (ReadObjMesh(meshPath, mtlPath, meshes) == false || CreateVertexSphereLists(meshes) == false)
+    {
+        return false;
+    }
+
+    return RenderAoScene(rtContext, stream, meshes, output);
+}
+
 template<>
 bool Render<CASE_TYPE::SCENE_TRANSFORMATION_MB_SAMPLING>(hiprtContext rtContext, hipStream_t stream, const fs::path& meshPath, const fs::path& mtlPath, const fs::path output)
 {
@@ -795,3 +842,71 @@ bool Render<CASE_TYPE::SCENE_TRANSFORMATION_MB_DEFORMATION>(hiprtContext rtConte
 
     return true;
 }
+
+// Host only render path, the same cases traced on the CPU for nodes without an AMD GPU
+template<CASE_TYPE type>
+bool RenderCpu(const fs::path& meshPath, const fs::path& mtlPath, const fs::path output)
+{
+    static_assert("Not implemented");
+}
+
+// host counterpart of RenderAoScene
+bool RenderAoSceneCpu(std::vector<TriangleMesh>& meshes, const fs::path output)
+{
+    // repeated runs on the same assets load the finished trees instead of building them
+    BvhBuildOptions bvhOptions;
+    bvhOptions.cacheDirectory = output.parent_path() / "bvh_cache";
+    HostScene scene;
+    if (CreateHostScene(meshes, bvhOptions, scene) == false)
+    {
+        return false;
+    }
+
+    // Camera
+    Camera camera;
+    camera.m_translation = make_float3(0.0f, 2.0f, 4.8f);
+    camera.m_rotation = make_float4(0.0f, 0.0f, 1.0f, 0.0f);
+    camera.m_fov = 45.0f * hiprt::Pi / 180.f;
+
+    CpuRenderSettings settings;
+    settings.resolution = make_int2(960, 540);
+    settings.aoRadius = 1.4f;
+
+    std::vector<uint8_t> image;
+    CpuRenderStats stats;
+    if (RenderAoCpu(scene, camera, settings, image, stats) == false)
+    {
+        return false;
+    }
+    PrintRenderStats("AO cpu", stats);
+
+    writeImageFromHost(output.string().c_str(), settings.resolution.x, settings.resolution.y, image.data());
+
+    return true;
+}
+
+template<>
+bool RenderCpu<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(const fs::path& meshPath, const fs::path& mtlPath, const fs::path output)
+{
+    std::vector<TriangleMesh> meshes;
+
+    if (ReadObjMesh(meshPath, mtlPath, meshes) == false)
+    {
+        return false;
+    }
+
+    return RenderAoSceneCpu(meshes, output);
+}
+
+template<>
+bool RenderCpu<CASE_TYPE::SCENE_AMBIENT_OCCLUSION_SPHERES>(const fs::path& meshPath, const fs::path& mtlPath, const fs::path output)
+{
+    std::vector<TriangleMesh> meshes;
+
+    if (ReadObjMesh(meshPath, mtlPath, meshes) == false || CreateVertexSphereLists(meshes) == false)
+    {
+        return false;
+    }
+
+    return RenderAoSceneCpu(meshes, output);
+}
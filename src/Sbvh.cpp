@@ -0,0 +1,451 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+// Spatial split BVH (Stich et al. 2009). Besides the usual object splits a node can be cut by a plane, triangles
+// crossing the plane are clipped and referenced from both sides. This trades build time and memory for tight boxes
+// around large or long triangles, where object splits leave heavily overlapping children.
+
+namespace {
+
+struct Reference
+{
+    hiprt::Aabb box;
+    uint32_t prim;
+};
+
+struct SpatialBin
+{
+    hiprt::Aabb box;
+    uint32_t entry{0};
+    uint32_t exit{0};
+};
+
+struct Split
+{
+    float cost{std::numeric_limits<float>::max()};
+    uint32_t axis{0};
+    // object split: number of references left of the split after sorting along axis
+    uint32_t leftCount{0};
+    // spatial split: plane position along axis and the number of references it duplicates
+    float position{0.0f};
+    uint32_t duplicates{0};
+    hiprt::Aabb left;
+    hiprt::Aabb right;
+};
+
+struct SbvhTask
+{
+    uint32_t node;
+    uint32_t depth;
+    // references this subtree may still duplicate
+    uint32_t budget;
+    std::vector<Reference> refs;
+};
+
+struct SbvhBuilder
+{
+    const float3* vertices;
+    const uint3* indices;
+    const BvhBuildOptions& options;
+    Bvh& bvh;
+
+    float minOverlap{0.0f};
+
+    std::vector<float>& rightArea;
+    std::vector<SpatialBin> bins;
+};
+
+bool IsEmpty(const hiprt::Aabb& box)
+{
+    return box.m_min.x > box.m_max.x || box.m_min.y > box.m_max.y || box.m_min.z > box.m_max.z;
+}
+
+float Area(const hiprt::Aabb& box)
+{
+    return IsEmpty(box) ? 0.0f : box.area();
+}
+
+uint32_t Log2Ceil(uint32_t value)
+{
+    uint32_t log = 0;
+    while ((1u << log) < value && log < 31) log++;
+    return log;
+}
+
+float Centroid(const Reference& ref, uint32_t axis)
+{
+    return hiprt::ptr(ref.box.m_min)[axis] + hiprt::ptr(ref.box.m_max)[axis];
+}
+
+void SortReferences(std::vector<Reference>& refs, uint32_t axis)
+{
+    std::sort(refs.begin(), refs.end(), [axis](const Reference& a, const Reference& b) {
+        float ca = Centroid(a, axis);
+        float cb = Centroid(b, axis);
+        return ca < cb || (ca == cb && a.prim < b.prim);
+    });
+}
+
+// clips the triangle of ref against the plane, both halves stay inside the original reference box
+void SplitReference(const SbvhBuilder& builder, const Reference& ref, uint32_t axis, float position, Reference& left, Reference& right)
+{
+    left.prim = ref.prim;
+    right.prim = ref.prim;
+    left.box.reset();
+    right.box.reset();
+
+    const uint3& t = builder.indices[ref.prim];
+    const float3 v[3] = {builder.vertices[t.x], builder.vertices[t.y], builder.vertices[t.z]};
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        const float3& v0 = v[i];
+        const float3& v1 = v[(i + 1) % 3];
+        const float p0 = hiprt::ptr(v0)[axis];
+        const float p1 = hiprt::ptr(v1)[axis];
+
+        if (p0 <= position)
+            left.box.grow(v0);
+        if (p0 >= position)
+            right.box.grow(v0);
+
+        if ((p0 < position && p1 > position) || (p0 > position && p1 < position))
+        {
+            const float s = std::min(std::max((position - p0) / (p1 - p0), 0.0f), 1.0f);
+            float3 p = v0 + (v1 - v0) * s;
+            hiprt::ptr(p)[axis] = position;
+            left.box.grow(p);
+            right.box.grow(p);
+        }
+    }
+
+    hiprt::ptr(left.box.m_max)[axis] = position;
+    hiprt::ptr(right.box.m_min)[axis] = position;
+    left.box.intersect(ref.box);
+    right.box.intersect(ref.box);
+}
+
+Split FindObjectSplit(SbvhBuilder& builder, std::vector<Reference>& refs, float parentArea)
+{
+    const uint32_t count = static_cast<uint32_t>(refs.size());
+    builder.rightArea.resize(count);
+
+    Split best;
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        SortReferences(refs, axis);
+
+        hiprt::Aabb box;
+        for (uint32_t i = count - 1; i > 0; i--)
+        {
+            box.grow(refs[i].box);
+            builder.rightArea[i] = box.area();
+        }
+
+        box.reset();
+        for (uint32_t i = 1; i < count; i++)
+        {
+            box.grow(refs[i - 1].box);
+            float cost = builder.options.traversalCost +
+                         builder.options.intersectionCost * (box.area() * i + builder.rightArea[i] * (count - i)) / parentArea;
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.leftCount = i;
+            }
+        }
+    }
+
+    SortReferences(refs, best.axis);
+    for (uint32_t i = 0; i < count; i++) (i < best.leftCount ? best.left : best.right).grow(refs[i].box);
+    return best;
+}
+
+Split FindSpatialSplit(SbvhBuilder& builder, const std::vector<Reference>& refs, const hiprt::Aabb& nodeBox, float parentArea)
+{
+    const uint32_t binCount = builder.options.binCount;
+    const float3 extent = nodeBox.extent();
+
+    Split best;
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        const float axisMin = hiprt::ptr(nodeBox.m_min)[axis];
+        const float axisExtent = hiprt::ptr(extent)[axis];
+        if (axisExtent <= 0.0f)
+            continue;
+
+        const float binSize = axisExtent / binCount;
+        auto binIndex = [&](float p) { return std::min(binCount - 1, static_cast<uint32_t>(std::max((p - axisMin) / binSize, 0.0f))); };
+
+        // every reference is chopped into the bins it spans
+        builder.bins.assign(binCount, SpatialBin{});
+        for (const auto& ref : refs)
+        {
+            const uint32_t first = binIndex(hiprt::ptr(ref.box.m_min)[axis]);
+            const uint32_t last = binIndex(hiprt::ptr(ref.box.m_max)[axis]);
+
+            Reference current = ref;
+            for (uint32_t b = first; b < last; b++)
+            {
+                Reference left, right;
+                SplitReference(builder, current, axis, axisMin + binSize * (b + 1), left, right);
+                if (!IsEmpty(left.box))
+                    builder.bins[b].box.grow(left.box);
+                current = right;
+            }
+            if (!IsEmpty(current.box))
+                builder.bins[last].box.grow(current.box);
+
+            builder.bins[first].entry++;
+            builder.bins[last].exit++;
+        }
+
+        hiprt::Aabb box;
+        uint32_t rightCount = 0;
+        builder.rightArea.resize(binCount);
+        std::vector<uint32_t> rightCounts(binCount);
+        for (uint32_t b = binCount - 1; b > 0; b--)
+        {
+            box.grow(builder.bins[b].box);
+            rightCount += builder.bins[b].exit;
+            builder.rightArea[b] = Area(box);
+            rightCounts[b] = rightCount;
+        }
+
+        box.reset();
+        uint32_t leftCount = 0;
+        for (uint32_t b = 1; b < binCount; b++)
+        {
+            box.grow(builder.bins[b - 1].box);
+            leftCount += builder.bins[b - 1].entry;
+            if (leftCount == 0 || rightCounts[b] == 0)
+                continue;
+
+            float cost = builder.options.traversalCost +
+                         builder.options.intersectionCost * (Area(box) * leftCount + builder.rightArea[b] * rightCounts[b]) / parentArea;
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = axisMin + binSize * b;
+                best.duplicates = leftCount + rightCounts[b] - static_cast<uint32_t>(refs.size());
+            }
+        }
+    }
+    return best;
+}
+
+// Distributes refs on both sides of the plane. Straddling references are either clipped or kept whole on one side,
+// whichever gives the lower SAH (reference unsplitting).
+void PartitionSpatial(const SbvhBuilder& builder, const std::vector<Reference>& refs, const Split& split, std::vector<Reference>& left, std::vector<Reference>& right)
+{
+    const uint32_t axis = split.axis;
+    hiprt::Aabb leftBox;
+    hiprt::Aabb rightBox;
+    std::vector<const Reference*> straddling;
+
+    for (const auto& ref : refs)
+    {
+        if (hiprt::ptr(ref.box.m_max)[axis] <= split.position)
+        {
+            left.push_back(ref);
+            leftBox.grow(ref.box);
+        }
+        else if (hiprt::ptr(ref.box.m_min)[axis] >= split.position)
+        {
+            right.push_back(ref);
+            rightBox.grow(ref.box);
+        }
+        else
+        {
+            straddling.push_back(&ref);
+        }
+    }
+
+    for (const Reference* ref : straddling)
+    {
+        Reference leftRef, rightRef;
+        SplitReference(builder, *ref, axis, split.position, leftRef, rightRef);
+
+        const float leftCount = static_cast<float>(left.size());
+        const float rightCount = static_cast<float>(right.size());
+        const float duplicateCost = Area(hiprt::Aabb(leftBox, leftRef.box)) * (leftCount + 1) + Area(hiprt::Aabb(rightBox, rightRef.box)) * (rightCount + 1);
+        const float unsplitLeftCost = Area(hiprt::Aabb(leftBox, ref->box)) * (leftCount + 1) + Area(rightBox) * rightCount;
+        const float unsplitRightCost = Area(leftBox) * leftCount + Area(hiprt::Aabb(rightBox, ref->box)) * (rightCount + 1);
+
+        if (unsplitLeftCost < duplicateCost && unsplitLeftCost <= unsplitRightCost)
+        {
+            left.push_back(*ref);
+            leftBox.grow(ref->box);
+        }
+        else if (unsplitRightCost < duplicateCost)
+        {
+            right.push_back(*ref);
+            rightBox.grow(ref->box);
+        }
+        else
+        {
+            if (IsEmpty(leftRef.box) || IsEmpty(rightRef.box))
+            {
+                // clipping degenerated (flat triangle lying in the plane), keep it whole
+                left.push_back(*ref);
+                leftBox.grow(ref->box);
+                continue;
+            }
+            left.push_back(leftRef);
+            right.push_back(rightRef);
+            leftBox.grow(leftRef.box);
+            rightBox.grow(rightRef.box);
+        }
+    }
+}
+
+void MakeLeaf(SbvhBuilder& builder, uint32_t node, const std::vector<Reference>& refs)
+{
+    BvhNode& leaf = builder.bvh.nodes[node];
+    leaf.primOffset = static_cast<uint32_t>(builder.bvh.primIndices.size());
+    leaf.primCount = static_cast<uint32_t>(refs.size());
+    for (const auto& ref : refs) builder.bvh.primIndices.push_back(ref.prim);
+}
+
+} // namespace
+
+bool BuildBvhSpatialSplits(const float3* vertices, const uint3* indices, uint32_t triangleCount, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch)
+{
+    bvh.nodes.clear();
+    bvh.primIndices.clear();
+
+    if (triangleCount == 0)
+    {
+        std::cerr << "Bvh build: no primitives\n";
+        return false;
+    }
+    if (options.binCount < 2 || options.maxLeafSize == 0 || options.duplicationBudget < 0.0f)
+    {
+        std::cerr << "Bvh build: invalid build options\n";
+        return false;
+    }
+
+    BvhBuildScratch localScratch;
+    SbvhBuilder builder{vertices, indices, options, bvh, 0.0f, scratch != nullptr ? scratch->sweepAreas : localScratch.sweepAreas, {}};
+
+    SbvhTask root{0, 0, static_cast<uint32_t>(triangleCount * options.duplicationBudget), {}};
+    root.refs.resize(triangleCount);
+    hiprt::Aabb rootBox;
+    for (uint32_t i = 0; i < triangleCount; i++)
+    {
+        const uint3& t = indices[i];
+        root.refs[i].prim = i;
+        root.refs[i].box = hiprt::Aabb(vertices[t.x]).grow(vertices[t.y]).grow(vertices[t.z]);
+        rootBox.grow(root.refs[i].box);
+    }
+
+    builder.minOverlap = rootBox.area() * options.spatialSplitAlpha;
+
+    bvh.nodes.reserve(2 * triangleCount);
+    bvh.nodes.emplace_back();
+
+    std::vector<SbvhTask> stack;
+    stack.push_back(std::move(root));
+
+    while (!stack.empty())
+    {
+        SbvhTask task = std::move(stack.back());
+        stack.pop_back();
+
+        std::vector<Reference>& refs = task.refs;
+        const uint32_t count = static_cast<uint32_t>(refs.size());
+
+        hiprt::Aabb nodeBox;
+        for (const auto& ref : refs) nodeBox.grow(ref.box);
+        bvh.nodes[task.node].box = nodeBox;
+
+        if (count == 1)
+        {
+            MakeLeaf(builder, task.node, refs);
+            continue;
+        }
+
+        const float parentArea = std::max(nodeBox.area(), std::numeric_limits<float>::min());
+        const Split objectSplit = FindObjectSplit(builder, refs, parentArea);
+
+        std::vector<Reference> left;
+        std::vector<Reference> right;
+
+        // spatial splits are tried only where the object split children overlap and the duplication budget allows
+        // it, close to the depth limit the tree falls back to plain object splits
+        Split spatialSplit;
+        const bool depthLimit = task.depth + Log2Ceil(count) + 1 >= MaxBvhDepth;
+        if (!depthLimit && task.budget > 0)
+        {
+            hiprt::Aabb overlap = objectSplit.left;
+            overlap.intersect(objectSplit.right);
+            if (Area(overlap) > builder.minOverlap)
+                spatialSplit = FindSpatialSplit(builder, refs, nodeBox, parentArea);
+        }
+
+        uint32_t budget = task.budget;
+        float splitCost = objectSplit.cost;
+        if (spatialSplit.cost < objectSplit.cost && spatialSplit.duplicates <= budget)
+        {
+            PartitionSpatial(builder, refs, spatialSplit, left, right);
+            const uint32_t duplicates = static_cast<uint32_t>(left.size() + right.size()) - count;
+
+            // the binned estimate can be off once references are unsplit, keep the split only if it still wins
+            hiprt::Aabb leftBox;
+            hiprt::Aabb rightBox;
+            for (const auto& ref : left) leftBox.grow(ref.box);
+            for (const auto& ref : right) rightBox.grow(ref.box);
+            const float cost = options.traversalCost + options.intersectionCost * (Area(leftBox) * left.size() + Area(rightBox) * right.size()) / parentArea;
+
+            if (left.empty() || right.empty() || duplicates > budget || cost >= objectSplit.cost)
+            {
+                left.clear();
+                right.clear();
+            }
+            else
+            {
+                budget -= duplicates;
+                splitCost = cost;
+            }
+        }
+
+        if (count <= options.maxLeafSize && options.intersectionCost * count <= splitCost)
+        {
+            MakeLeaf(builder, task.node, refs);
+            continue;
+        }
+
+        if (left.empty())
+        {
+            // near the depth limit the references are halved in the sorted order of the object split, the SAH split
+            // of coincident boxes peels one reference per level and would run past MaxBvhDepth
+            const uint32_t leftCount = depthLimit ? count / 2 : objectSplit.leftCount;
+            left.assign(refs.begin(), refs.begin() + leftCount);
+            right.assign(refs.begin() + leftCount, refs.end());
+        }
+
+        refs.clear();
+        refs.shrink_to_fit();
+
+        const uint32_t leftNode = static_cast<uint32_t>(bvh.nodes.size());
+        bvh.nodes.emplace_back();
+        bvh.nodes.emplace_back();
+        bvh.nodes[task.node].child[0] = leftNode;
+        bvh.nodes[task.node].child[1] = leftNode + 1;
+        bvh.nodes[leftNode].parent = task.node;
+        bvh.nodes[leftNode + 1].parent = task.node;
+
+        // the remaining budget is shared by the children in proportion to their size, so the first subtree
+        // built does not use it all up
+        const uint32_t leftBudget = static_cast<uint32_t>(static_cast<uint64_t>(budget) * left.size() / (left.size() + right.size()));
+        const uint32_t rightBudget = budget - leftBudget;
+        stack.push_back({leftNode + 1, task.depth + 1, rightBudget, std::move(right)});
+        stack.push_back({leftNode, task.depth + 1, leftBudget, std::move(left)});
+    }
+
+    return true;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Aabb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <hiprt/hiprt.h>
+
+// Object to world transform of an instance at one time: world = rotation * (scale * object) + translation.
+// hiprtFrameSRT keeps the rotation as axis (xyz) and angle (w), here it is a unit quaternion (xyz vector, w scalar).
+struct SrtTransform
+{
+    float4 rotation;
+    float3 scale;
+    float3 translation;
+};
+
+inline float4 AxisAngleToQuaternion(const float4& axisAngle)
+{
+    const float3 axis = make_float3(axisAngle.x, axisAngle.y, axisAngle.z);
+    const float length = sqrtf(hiprt::dot(axis, axis));
+    if (length == 0.0f || axisAngle.w == 0.0f)
+        return make_float4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    const float s = sinf(axisAngle.w * 0.5f) / length;
+    return make_float4(axis.x * s, axis.y * s, axis.z * s, cosf(axisAngle.w * 0.5f));
+}
+
+// shortest arc, falls back to a normalized lerp for nearly equal rotations
+inline float4 Slerp(const float4& a, float4 b, float t)
+{
+    float cosTheta = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    if (cosTheta < 0.0f)
+    {
+        b = make_float4(-b.x, -b.y, -b.z, -b.w);
+        cosTheta = -cosTheta;
+    }
+
+    float wa = 1.0f - t;
+    float wb = t;
+    if (cosTheta < 0.9995f)
+    {
+        const float theta = acosf(cosTheta);
+        const float sinTheta = sinf(theta);
+        wa = sinf((1.0f - t) * theta) / sinTheta;
+        wb = sinf(t * theta) / sinTheta;
+    }
+
+    float4 q = make_float4(a.x * wa + b.x * wb, a.y * wa + b.y * wb, a.z * wa + b.z * wb, a.w * wa + b.w * wb);
+    const float invLength = 1.0f / sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    return make_float4(q.x * invLength, q.y * invLength, q.z * invLength, q.w * invLength);
+}
+
+inline float3 RotateQuaternion(const float4& q, const float3& p)
+{
+    const float3 u = make_float3(q.x, q.y, q.z);
+    const float3 t = 2.0f * hiprt::cross(u, p);
+    return p + q.w * t + hiprt::cross(u, t);
+}
+
+inline float4 ConjugateQuaternion(const float4& q)
+{
+    return make_float4(-q.x, -q.y, -q.z, q.w);
+}
+
+inline SrtTransform ToSrtTransform(const hiprtFrameSRT& frame)
+{
+    return {AxisAngleToQuaternion(frame.rotation), frame.scale, frame.translation};
+}
+
+// frames are sorted by time, times outside the range clamp to the first or last frame
+inline SrtTransform InterpolateFrames(const hiprtFrameSRT* frames, uint32_t frameCount, float time)
+{
+    if (frameCount == 1 || time <= frames[0].time)
+        return ToSrtTransform(frames[0]);
+    if (time >= frames[frameCount - 1].time)
+        return ToSrtTransform(frames[frameCount - 1]);
+
+    uint32_t i = 0;
+    while (i + 2 < frameCount && frames[i + 1].time <= time) i++;
+
+    const hiprtFrameSRT& f0 = frames[i];
+    const hiprtFrameSRT& f1 = frames[i + 1];
+    const float dt = f1.time - f0.time;
+    const float t = dt > 0.0f ? (time - f0.time) / dt : 0.0f;
+
+    SrtTransform transform;
+    transform.translation = f0.translation + (f1.translation - f0.translation) * t;
+    transform.scale = f0.scale + (f1.scale - f0.scale) * t;
+    transform.rotation = Slerp(AxisAngleToQuaternion(f0.rotation), AxisAngleToQuaternion(f1.rotation), t);
+    return transform;
+}
+
+inline float3 TransformPoint(const SrtTransform& transform, const float3& p)
+{
+    return RotateQuaternion(transform.rotation, transform.scale * p) + transform.translation;
+}
+
+// The direction is not renormalized so hit distances are the same in both spaces
+inline hiprtRay InverseTransformRay(const SrtTransform& transform, const hiprtRay& ray)
+{
+    const float4 inverseRotation = ConjugateQuaternion(transform.rotation);
+    hiprtRay objectRay = ray;
+    objectRay.origin = RotateQuaternion(inverseRotation, ray.origin - transform.translation) / transform.scale;
+    objectRay.direction = RotateQuaternion(inverseRotation, ray.direction) / transform.scale;
+    return objectRay;
+}
+
+// inverse transpose of the linear part
+inline float3 TransformNormal(const SrtTransform& transform, const float3& n)
+{
+    return RotateQuaternion(transform.rotation, n / transform.scale);
+}
+
+// World box of an object box moving through the key frames. Between two frames with the same rotation every point
+// moves linearly and the boxes at the two frames bound the motion. When the rotation changes the object sweeps
+// around its origin, that part is bounded by the sphere through the farthest box corner.
+inline hiprt::Aabb ComputeMotionBounds(const hiprt::Aabb& objectBox, const hiprtFrameSRT* frames, uint32_t frameCount)
+{
+    auto transformedBox = [&](const SrtTransform& transform) {
+        hiprt::Aabb box;
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            const float3 corner = make_float3(c & 1 ? objectBox.m_max.x : objectBox.m_min.x, c & 2 ? objectBox.m_max.y : objectBox.m_min.y, c & 4 ? objectBox.m_max.z : objectBox.m_min.z);
+            box.grow(TransformPoint(transform, corner));
+        }
+        return box;
+    };
+    auto sphereRadius = [&](const float3& scale) {
+        const float3 lo = objectBox.m_min * scale;
+        const float3 hi = objectBox.m_max * scale;
+        const float3 farCorner = hiprt::max(hiprt::max(lo, -lo), hiprt::max(hi, -hi));
+        return sqrtf(hiprt::dot(farCorner, farCorner));
+    };
+
+    hiprt::Aabb bounds = transformedBox(ToSrtTransform(frames[0]));
+    for (uint32_t i = 1; i < frameCount; i++)
+    {
+        const hiprtFrameSRT& f0 = frames[i - 1];
+        const hiprtFrameSRT& f1 = frames[i];
+        bounds.grow(transformedBox(ToSrtTransform(f1)));
+
+        const bool rotates = f0.rotation.x != f1.rotation.x || f0.rotation.y != f1.rotation.y || f0.rotation.z != f1.rotation.z || f0.rotation.w != f1.rotation.w;
+        if (rotates)
+        {
+            // the scale is linear in time, its largest sphere is at one of the frames
+            const float radius = std::max(sphereRadius(f0.scale), sphereRadius(f1.scale));
+            const float3 r = make_float3(radius);
+            bounds.grow(hiprt::Aabb(f0.translation - r, f0.translation + r));
+            bounds.grow(hiprt::Aabb(f1.translation - r, f1.translation + r));
+        }
+    }
+    return bounds;
+}
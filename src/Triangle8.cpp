@@ -0,0 +1,112 @@
+#include "Triangle8.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+constexpr uint32_t ChunkSize = 1024;
+
+struct LeafRange
+{
+    uint32_t primOffset;
+    uint32_t primCount;
+};
+
+bool BuildBlocks(const float3* vertices, const uint3* indices, const std::vector<uint32_t>& primIndices, const std::vector<LeafRange>& leafRanges, TriangleLeaves& leaves)
+{
+    leaves.blocks.clear();
+    leaves.leafBlocks.assign(primIndices.size(), InvalidNodeIndex);
+
+    uint32_t blockCount = 0;
+    for (const LeafRange& leaf : leafRanges)
+    {
+        if (leaf.primOffset + leaf.primCount > primIndices.size())
+        {
+            std::cerr << "Triangle leaves: leaf out of the primitive range\n";
+            return false;
+        }
+        leaves.leafBlocks[leaf.primOffset] = blockCount;
+        blockCount += (leaf.primCount + Triangle8Width - 1) / Triangle8Width;
+    }
+    // value initialized, the unused lanes stay zero
+    leaves.blocks.resize(blockCount);
+
+    const uint32_t leafCount = static_cast<uint32_t>(leafRanges.size());
+    ParallelFor((leafCount + ChunkSize - 1) / ChunkSize, [&](uint32_t chunk, uint32_t) {
+        const uint32_t end = std::min(leafCount, (chunk + 1) * ChunkSize);
+        for (uint32_t leafIndex = chunk * ChunkSize; leafIndex < end; leafIndex++)
+        {
+            const LeafRange& leaf = leafRanges[leafIndex];
+            Triangle8* blocks = &leaves.blocks[leaves.leafBlocks[leaf.primOffset]];
+            for (uint32_t i = 0; i < leaf.primCount; i++)
+            {
+                Triangle8& block = blocks[i / Triangle8Width];
+                const uint32_t lane = i % Triangle8Width;
+                const uint32_t primIndex = primIndices[leaf.primOffset + i];
+                const uint3& t = indices[primIndex];
+                const float3 p0 = vertices[t.x];
+                const float3 e1 = vertices[t.y] - p0;
+                const float3 e2 = vertices[t.z] - p0;
+                const float3 n = hiprt::cross(e1, e2);
+
+                block.v0x[lane] = p0.x;
+                block.v0y[lane] = p0.y;
+                block.v0z[lane] = p0.z;
+                block.e1x[lane] = e1.x;
+                block.e1y[lane] = e1.y;
+                block.e1z[lane] = e1.z;
+                block.e2x[lane] = e2.x;
+                block.e2y[lane] = e2.y;
+                block.e2z[lane] = e2.z;
+                block.nx[lane] = n.x;
+                block.ny[lane] = n.y;
+                block.nz[lane] = n.z;
+                block.primIndex[lane] = primIndex;
+            }
+        }
+    });
+    return true;
+}
+
+} // namespace
+
+bool BuildTriangleLeaves(const float3* vertices, const uint3* indices, const Bvh& bvh, TriangleLeaves& leaves)
+{
+    std::vector<LeafRange> leafRanges;
+    for (const BvhNode& node : bvh.nodes)
+    {
+        if (node.IsLeaf())
+            leafRanges.push_back({node.primOffset, node.primCount});
+    }
+    return BuildBlocks(vertices, indices, bvh.primIndices, leafRanges, leaves);
+}
+
+bool BuildTriangleLeaves(const float3* vertices, const uint3* indices, const Bvh8& bvh8, TriangleLeaves& leaves)
+{
+    std::vector<LeafRange> leafRanges;
+    for (const Bvh8Node& node : bvh8.nodes)
+    {
+        for (uint32_t i = 0; i < node.childCount; i++)
+        {
+            if (node.primCount[i] > 0)
+                leafRanges.push_back({node.child[i], node.primCount[i]});
+        }
+    }
+    return BuildBlocks(vertices, indices, bvh8.primIndices, leafRanges, leaves);
+}
+
+bool BuildTriangleLeaves(const float3* vertices, const uint3* indices, const CompressedBvh8& compressedBvh8, TriangleLeaves& leaves)
+{
+    std::vector<LeafRange> leafRanges;
+    for (const CompressedBvh8Node& node : compressedBvh8.nodes)
+    {
+        for (uint32_t i = 0; i < node.childCount; i++)
+        {
+            if (node.primCount[i] > 0)
+                leafRanges.push_back({ChildIndex(node, i), node.primCount[i]});
+        }
+    }
+    return BuildBlocks(vertices, indices, compressedBvh8.primIndices, leafRanges, leaves);
+}
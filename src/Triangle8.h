@@ -0,0 +1,167 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+#include "Bvh8.h"
+#include "CompressedBvh8.h"
+
+#include <bit>
+#include <vector>
+
+#if defined(__AVX2__)
+#    include <immintrin.h>
+#endif
+
+constexpr uint32_t Triangle8Width = 8;
+
+// Up to eight triangles of one leaf with the first vertex, both edges and the unnormalized normal cross(e1, e2)
+// precomputed in SoA layout, so one intersection test covers all of them. Unused lanes are zero, a zero normal never hits.
+struct alignas(32) Triangle8
+{
+    float v0x[Triangle8Width];
+    float v0y[Triangle8Width];
+    float v0z[Triangle8Width];
+    float e1x[Triangle8Width];
+    float e1y[Triangle8Width];
+    float e1z[Triangle8Width];
+    float e2x[Triangle8Width];
+    float e2y[Triangle8Width];
+    float e2z[Triangle8Width];
+    float nx[Triangle8Width];
+    float ny[Triangle8Width];
+    float nz[Triangle8Width];
+    uint32_t primIndex[Triangle8Width];
+};
+
+// Triangle8 blocks of the leaves of one Bvh layout. leafBlocks[primOffset] is the first block of the leaf whose
+// primitives start at primOffset in the primIndices of that layout, a leaf of n primitives uses (n + 7) / 8 blocks.
+struct TriangleLeaves
+{
+    std::vector<Triangle8> blocks;
+    std::vector<uint32_t> leafBlocks;
+};
+
+// the vertices are copied into the blocks, they have to be rebuilt when the geometry changes
+bool BuildTriangleLeaves(const float3* vertices, const uint3* indices, const Bvh& bvh, TriangleLeaves& leaves);
+
+bool BuildTriangleLeaves(const float3* vertices, const uint3* indices, const Bvh8& bvh8, TriangleLeaves& leaves);
+
+bool BuildTriangleLeaves(const float3* vertices, const uint3* indices, const CompressedBvh8& compressedBvh8, TriangleLeaves& leaves);
+
+// Bit per triangle of the block hit with t in [ray.minT, maxT]. t = dot(v0 - o, n) / dot(d, n) and the barycentrics come
+// from q = cross(o - v0, d). t, u and v of the hit lanes are written unless they are null, occlusion queries skip them.
+inline uint32_t Triangle8HitMask(const Triangle8& tri, const hiprtRay& ray, float maxT, float* t, float* u, float* v)
+{
+#if defined(__AVX2__)
+#    if defined(__FMA__) || defined(_MSC_VER)
+    auto mul_add = [](__m256 a, __m256 b, __m256 c) { return _mm256_fmadd_ps(a, b, c); };
+    auto mul_sub = [](__m256 a, __m256 b, __m256 c) { return _mm256_fmsub_ps(a, b, c); };
+#    else
+    auto mul_add = [](__m256 a, __m256 b, __m256 c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); };
+    auto mul_sub = [](__m256 a, __m256 b, __m256 c) { return _mm256_sub_ps(_mm256_mul_ps(a, b), c); };
+#    endif
+    auto dot = [&](__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) { return mul_add(ax, bx, mul_add(ay, by, _mm256_mul_ps(az, bz))); };
+
+    const __m256 dx = _mm256_set1_ps(ray.direction.x);
+    const __m256 dy = _mm256_set1_ps(ray.direction.y);
+    const __m256 dz = _mm256_set1_ps(ray.direction.z);
+
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(tri.v0x));
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(tri.v0y));
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(tri.v0z));
+    const __m256 nx = _mm256_load_ps(tri.nx);
+    const __m256 ny = _mm256_load_ps(tri.ny);
+    const __m256 nz = _mm256_load_ps(tri.nz);
+
+    const __m256 qx = mul_sub(sy, dz, _mm256_mul_ps(sz, dy));
+    const __m256 qy = mul_sub(sz, dx, _mm256_mul_ps(sx, dz));
+    const __m256 qz = mul_sub(sx, dy, _mm256_mul_ps(sy, dx));
+
+    // the tests run on the numerators scaled by the sign of the denominator, the division is only paid on a hit
+    const __m256 den = dot(dx, dy, dz, nx, ny, nz);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 denSign = _mm256_and_ps(den, signMask);
+    const __m256 absDen = _mm256_andnot_ps(signMask, den);
+
+    const __m256 tScaled = _mm256_xor_ps(_mm256_sub_ps(_mm256_setzero_ps(), dot(sx, sy, sz, nx, ny, nz)), denSign);
+    const __m256 uScaled = _mm256_xor_ps(_mm256_sub_ps(_mm256_setzero_ps(), dot(_mm256_load_ps(tri.e2x), _mm256_load_ps(tri.e2y), _mm256_load_ps(tri.e2z), qx, qy, qz)), denSign);
+    const __m256 vScaled = _mm256_xor_ps(dot(_mm256_load_ps(tri.e1x), _mm256_load_ps(tri.e1y), _mm256_load_ps(tri.e1z), qx, qy, qz), denSign);
+
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 valid = _mm256_cmp_ps(absDen, zero, _CMP_GT_OQ);
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(uScaled, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(vScaled, zero, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(uScaled, vScaled), absDen, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(tScaled, _mm256_mul_ps(_mm256_set1_ps(ray.minT), absDen), _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(tScaled, _mm256_mul_ps(_mm256_set1_ps(maxT), absDen), _CMP_LE_OQ));
+
+    const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(valid));
+    if (mask == 0 || t == nullptr)
+        return mask;
+
+    const __m256 invDen = _mm256_div_ps(_mm256_set1_ps(1.0f), absDen);
+    _mm256_storeu_ps(t, _mm256_mul_ps(tScaled, invDen));
+    _mm256_storeu_ps(u, _mm256_mul_ps(uScaled, invDen));
+    _mm256_storeu_ps(v, _mm256_mul_ps(vScaled, invDen));
+    return mask;
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < Triangle8Width; i++)
+    {
+        const float3 s = ray.origin - make_float3(tri.v0x[i], tri.v0y[i], tri.v0z[i]);
+        const float3 n = make_float3(tri.nx[i], tri.ny[i], tri.nz[i]);
+        const float den = hiprt::dot(ray.direction, n);
+        if (den == 0.0f)
+            continue;
+
+        const float3 q = hiprt::cross(s, ray.direction);
+        const float invDen = 1.0f / den;
+        const float tHit = -hiprt::dot(s, n) * invDen;
+        const float uHit = -hiprt::dot(make_float3(tri.e2x[i], tri.e2y[i], tri.e2z[i]), q) * invDen;
+        const float vHit = hiprt::dot(make_float3(tri.e1x[i], tri.e1y[i], tri.e1z[i]), q) * invDen;
+        if (uHit < 0.0f || vHit < 0.0f || uHit + vHit > 1.0f || tHit < ray.minT || tHit > maxT)
+            continue;
+
+        mask |= 1u << i;
+        if (t == nullptr)
+            return mask;
+        t[i] = tHit;
+        u[i] = uHit;
+        v[i] = vHit;
+    }
+    return mask;
+#endif
+}
+
+// Closest hit among the triangles of the block, same hit record as IntersectTriangle
+inline bool IntersectTriangle8(const Triangle8& tri, const hiprtRay& ray, float maxT, hiprtHit& hit)
+{
+    alignas(32) float t[Triangle8Width];
+    alignas(32) float u[Triangle8Width];
+    alignas(32) float v[Triangle8Width];
+
+    uint32_t mask = Triangle8HitMask(tri, ray, maxT, t, u, v);
+    if (mask == 0)
+        return false;
+
+    uint32_t closest = static_cast<uint32_t>(std::countr_zero(mask));
+    for (mask &= mask - 1; mask != 0; mask &= mask - 1)
+    {
+        const uint32_t i = static_cast<uint32_t>(std::countr_zero(mask));
+        if (t[i] < t[closest])
+            closest = i;
+    }
+
+    hit.t = t[closest];
+    hit.uv.x = u[closest];
+    hit.uv.y = v[closest];
+    hit.normal = make_float3(tri.nx[closest], tri.ny[closest], tri.nz[closest]);
+    hit.primID = tri.primIndex[closest];
+    return true;
+}
+
+// true when any triangle of the block blocks the ray within [ray.minT, maxT], nothing else is computed
+inline bool OccludedTriangle8(const Triangle8& tri, const hiprtRay& ray, float maxT)
+{
+    return Triangle8HitMask(tri, ray, maxT, nullptr, nullptr, nullptr) != 0;
+}
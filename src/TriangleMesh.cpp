@@ -1,8 +1,7 @@
 #include "TriangleMesh.h"
-#include "assert.h"
 #include "../kernels/Math.h"
 
-#include <hip/hip_runtime.h>
+#include <algorithm>
 
  TriangleMesh::TriangleMesh()
  {
@@ -10,51 +9,43 @@
     mesh.vertices = nullptr;
  }
 
+TriangleMesh::~TriangleMesh()
+{
+    if (releaseDeviceBuffers != nullptr)
+        releaseDeviceBuffers(*this);
+}
+
 uint32_t TriangleMesh::GetNumVertices()
  {
     return vertices.size() / deformation_count;
  }
 
- void TriangleMesh::Build()
+void TriangleMesh::BuildAABB()
 {
-    BuildAABB();
-
-    HIP_ASSERT( hipSuccess == hipMalloc(&device_aabb, aabb.size()*sizeof(hiprt::Aabb)), "aabb malloc");
-    HIP_ASSERT( hipSuccess == hipMemcpyHtoD(device_aabb, aabb.data(), aabb.size()*sizeof(hiprt::Aabb)), "aabb copy");
-
-    mesh.triangleCount = (uint32_t) indices.size();
-    mesh.triangleStride = sizeof( uint3 );
-
-    HIP_ASSERT( hipSuccess == hipMalloc(&mesh.triangleIndices, mesh.triangleCount * mesh.triangleStride), "hipMalloc");
-    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(mesh.triangleIndices, indices.data(), mesh.triangleCount * mesh.triangleStride), "memcpyH2D");
-    
-    mesh.vertexCount = vertices.size(); // GetNumVertices();
-    mesh.vertexStride = sizeof( float3 );
-
-    // mesh.vertexCount - 1st deformation
-    float3* ptr = &vertices[0];
-    
-    HIP_ASSERT(hipSuccess == hipMalloc(&mesh.vertices, mesh.vertexCount * mesh.vertexStride), "hipMalloc");
-    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(mesh.vertices, ptr, mesh.vertexCount * mesh.vertexStride), "memcpyH2D");
-
-
-    // send normals to device;
-    HIP_ASSERT(hipSuccess == hipMalloc(&device_vertex_normals, vertex_normals.size()* sizeof(float3)), "hipMalloc");
-    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(device_vertex_normals, vertex_normals.data(), vertex_normals.size() * sizeof(float3)), "memcpyH2D");
-
-    HIP_ASSERT(hipSuccess == hipMalloc(&device_tirangle_normals, triangle_normals.size() * sizeof(float3)), "hipMalloc");
-    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(device_tirangle_normals, triangle_normals.data(), triangle_normals.size() * sizeof(float3)), "memcpyH2D"); 
+    BuildAABB(0);
 }
 
-void TriangleMesh::BuildAABB()
+void TriangleMesh::BuildAABB(uint32_t deformation)
 {
+    if (!spheres.empty())
+    {
+        aabb.resize(spheres.size());
+        for (size_t i = 0; i < spheres.size(); i++)
+        {
+            const float4& s = spheres[i];
+            aabb[i] = hiprt::Aabb(make_float3(s.x - s.w, s.y - s.w, s.z - s.w), make_float3(s.x + s.w, s.y + s.w, s.z + s.w));
+        }
+        return;
+    }
+
+    const float3* frame = &vertices[deformation * GetNumVertices()];
     aabb.clear();
     aabb.reserve(indices.size());
     for(const auto& t : indices)
     {
-        auto& v0 = vertices[t.x];
-        auto& v1 = vertices[t.y];
-        auto& v2 = vertices[t.z];
+        auto& v0 = frame[t.x];
+        auto& v1 = frame[t.y];
+        auto& v2 = frame[t.z];
 
         hiprt::Aabb box(v0);
         box.grow(v1);
@@ -64,64 +55,34 @@ void TriangleMesh::BuildAABB()
     }
 }
 
-
-hiprtGeometryBuildInput TriangleMesh::CreateBuildInput( GEOMETRY_TYPE type)
+void TriangleMesh::BuildMotionAABB()
 {
-   
-    hiprtGeometryBuildInput geometryBuildInput;
-    memset(&geometryBuildInput, 0, sizeof(hiprtGeometryBuildInput));
-    geometryBuildInput.geomType = static_cast<uint32_t>(type);
-    switch (type)
+    BuildAABB(0);
+    const uint32_t numVertices = GetNumVertices();
+    for (uint32_t deformation = 1; deformation < deformation_count; deformation++)
     {
-    case GEOMETRY_TYPE::TRIANGLE_MESH:
-        geometryBuildInput.type = hiprtPrimitiveTypeTriangleMesh;
-        geometryBuildInput.primitive.triangleMesh = mesh;
-        break;
-    case GEOMETRY_TYPE::AABB_LIST:
-        geometryBuildInput.type = hiprtPrimitiveTypeAABBList;
-        geometryBuildInput.primitive.aabbList.aabbCount = aabb.size();
-        geometryBuildInput.primitive.aabbList.aabbStride = sizeof(hiprt::Aabb);
-        geometryBuildInput.primitive.aabbList.aabbs = device_aabb;
-        break;
-    default:
-        std::cerr << "Error to create GeometryType\n";
-    }
-    return geometryBuildInput; 
-}
-
-TriangleMesh::~TriangleMesh()
-{
-    HIP_ASSERT( hipSuccess == hipFree(mesh.vertices), "hipfree");
-    HIP_ASSERT( hipSuccess == hipFree(mesh.triangleIndices), "hipfree");
-    HIP_ASSERT(hipSuccess == hipFree(device_vertex_normals), "free normals");
-    HIP_ASSERT(hipSuccess == hipFree(device_tirangle_normals), "free normals");
-    HIP_ASSERT(hipSuccess == hipFree(device_aabb), "free aabbs");
-}
-
-void BuildMeshes(std::vector<TriangleMesh>& meshes)
-{
-    for(auto& mesh : meshes)
-    {
-        mesh.Build();
+        const float3* frame = &vertices[deformation * numVertices];
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            const uint3& t = indices[i];
+            aabb[i].grow(frame[t.x]);
+            aabb[i].grow(frame[t.y]);
+            aabb[i].grow(frame[t.z]);
+        }
     }
 }
 
-void CollectGeometryBuildInputs(std::vector<hiprtGeometryBuildInput>& inputs, std::vector<TriangleMesh>& meshes)
+void CreateVertexSpheres(const TriangleMesh& mesh, float radius, TriangleMesh& sphereList)
 {
-    inputs.clear();
-    inputs.reserve(meshes.size());
-    for(auto& mesh: meshes)
+    const size_t vertexCount = mesh.vertices.size() / mesh.deformation_count;
+    sphereList.spheres.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
     {
-        if (mesh.deformation_count > 1)
-        {
-            inputs.push_back(mesh.CreateBuildInput(GEOMETRY_TYPE::AABB_LIST));
-        }
-        else 
-            inputs.push_back(mesh.CreateBuildInput(GEOMETRY_TYPE::TRIANGLE_MESH));
+        const float3& v = mesh.vertices[i];
+        sphereList.spheres[i] = make_float4(v.x, v.y, v.z, radius);
     }
 }
 
-
 BoundingBox3D compute_axis_aligned_bounding_box(const std::vector<float3>& vertices)
 {
     BoundingBox3D bbox;
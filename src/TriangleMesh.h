@@ -21,6 +21,8 @@ enum class GEOMETRY_TYPE : uint32_t
     //TRIANGLE_MESH_DEFORMED,
 
     AABB_LIST,
+    // analytic spheres of TriangleMesh::spheres, an AABB_LIST with its own intersector
+    SPHERE_LIST,
     
     GEOMETRY_TYPE_COUNT
 };
@@ -32,6 +34,8 @@ struct TriangleMesh
     std::vector<float3> vertex_normals;
     std::vector<float3> triangle_normals;
     std::vector<hiprt::Aabb> aabb;
+    // center in xyz and radius in w. A mesh with spheres is a sphere list: it has no triangles and aabb bounds the spheres.
+    std::vector<float4> spheres;
 
     uint32_t deformation_count{1};
 
@@ -39,10 +43,17 @@ struct TriangleMesh
     hiprtDevicePtr device_vertex_normals{nullptr}; 
     hiprtDevicePtr device_tirangle_normals {nullptr};
     hiprtDevicePtr device_aabb{nullptr};
+    hiprtDevicePtr device_spheres{nullptr};
+    // set by Build (TriangleMeshDevice.cpp), so meshes that never went to the device do not need the hip runtime
+    void (*releaseDeviceBuffers)(TriangleMesh& mesh){nullptr};
 
     uint32_t GetNumVertices();
     void Build();
     void BuildAABB();
+    // per triangle boxes of one deformation key frame
+    void BuildAABB(uint32_t deformation);
+    // per triangle boxes bounding all deformation key frames, what the AABB_LIST geometry of a deformed mesh needs
+    void BuildMotionAABB();
     hiprtGeometryBuildInput CreateBuildInput( GEOMETRY_TYPE type);
 
     TriangleMesh();
@@ -54,6 +65,10 @@ struct TriangleMesh
 
 void BuildMeshes(std::vector<TriangleMesh>& meshes);
 
+// One analytic sphere of the given radius per vertex of the first key frame, a point cloud view of a mesh. 16 bytes per
+// sphere against the hundreds of bytes of a tessellated one.
+void CreateVertexSpheres(const TriangleMesh& mesh, float radius, TriangleMesh& sphereList);
+
 void CollectGeometryBuildInputs(std::vector<hiprtGeometryBuildInput>& inputs, std::vector<TriangleMesh>& meshes);
 
 void ApplyDeformation(uint32_t numDeformations, TriangleMesh& mesh);
\ No newline at end of file
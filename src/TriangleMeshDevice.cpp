@@ -0,0 +1,125 @@
+#include "TriangleMesh.h"
+#include "assert.h"
+
+#include <hip/hip_runtime.h>
+#include <cstring>
+#include <iostream>
+
+// the device side of TriangleMesh, host only tools leave this file out and never upload a mesh
+
+namespace {
+
+void ReleaseDeviceBuffers(TriangleMesh& mesh)
+{
+    HIP_ASSERT( hipSuccess == hipFree(mesh.mesh.vertices), "hipfree");
+    HIP_ASSERT( hipSuccess == hipFree(mesh.mesh.triangleIndices), "hipfree");
+    HIP_ASSERT(hipSuccess == hipFree(mesh.device_vertex_normals), "free normals");
+    HIP_ASSERT(hipSuccess == hipFree(mesh.device_tirangle_normals), "free normals");
+    HIP_ASSERT(hipSuccess == hipFree(mesh.device_aabb), "free aabbs");
+    HIP_ASSERT(hipSuccess == hipFree(mesh.device_spheres), "free spheres");
+}
+
+} // namespace
+
+ void TriangleMesh::Build()
+{
+    releaseDeviceBuffers = &ReleaseDeviceBuffers;
+
+    if (!spheres.empty())
+    {
+        BuildAABB();
+        HIP_ASSERT(hipSuccess == hipMalloc(&device_aabb, aabb.size() * sizeof(hiprt::Aabb)), "aabb malloc");
+        HIP_ASSERT(hipSuccess == hipMemcpyHtoD(device_aabb, aabb.data(), aabb.size() * sizeof(hiprt::Aabb)), "aabb copy");
+        HIP_ASSERT(hipSuccess == hipMalloc(&device_spheres, spheres.size() * sizeof(float4)), "spheres malloc");
+        HIP_ASSERT(hipSuccess == hipMemcpyHtoD(device_spheres, spheres.data(), spheres.size() * sizeof(float4)), "spheres copy");
+        return;
+    }
+
+    if (deformation_count > 1)
+        BuildMotionAABB();
+    else
+        BuildAABB();
+
+    HIP_ASSERT( hipSuccess == hipMalloc(&device_aabb, aabb.size()*sizeof(hiprt::Aabb)), "aabb malloc");
+    HIP_ASSERT( hipSuccess == hipMemcpyHtoD(device_aabb, aabb.data(), aabb.size()*sizeof(hiprt::Aabb)), "aabb copy");
+
+    mesh.triangleCount = (uint32_t) indices.size();
+    mesh.triangleStride = sizeof( uint3 );
+
+    HIP_ASSERT( hipSuccess == hipMalloc(&mesh.triangleIndices, mesh.triangleCount * mesh.triangleStride), "hipMalloc");
+    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(mesh.triangleIndices, indices.data(), mesh.triangleCount * mesh.triangleStride), "memcpyH2D");
+    
+    mesh.vertexCount = vertices.size(); // GetNumVertices();
+    mesh.vertexStride = sizeof( float3 );
+
+    // mesh.vertexCount - 1st deformation
+    float3* ptr = &vertices[0];
+    
+    HIP_ASSERT(hipSuccess == hipMalloc(&mesh.vertices, mesh.vertexCount * mesh.vertexStride), "hipMalloc");
+    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(mesh.vertices, ptr, mesh.vertexCount * mesh.vertexStride), "memcpyH2D");
+
+
+    // send normals to device;
+    HIP_ASSERT(hipSuccess == hipMalloc(&device_vertex_normals, vertex_normals.size()* sizeof(float3)), "hipMalloc");
+    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(device_vertex_normals, vertex_normals.data(), vertex_normals.size() * sizeof(float3)), "memcpyH2D");
+
+    HIP_ASSERT(hipSuccess == hipMalloc(&device_tirangle_normals, triangle_normals.size() * sizeof(float3)), "hipMalloc");
+    HIP_ASSERT(hipSuccess == hipMemcpyHtoD(device_tirangle_normals, triangle_normals.data(), triangle_normals.size() * sizeof(float3)), "memcpyH2D"); 
+}
+
+hiprtGeometryBuildInput TriangleMesh::CreateBuildInput( GEOMETRY_TYPE type)
+{
+   
+    hiprtGeometryBuildInput geometryBuildInput;
+    memset(&geometryBuildInput, 0, sizeof(hiprtGeometryBuildInput));
+    geometryBuildInput.geomType = static_cast<uint32_t>(type);
+    switch (type)
+    {
+    case GEOMETRY_TYPE::TRIANGLE_MESH:
+        geometryBuildInput.type = hiprtPrimitiveTypeTriangleMesh;
+        geometryBuildInput.primitive.triangleMesh = mesh;
+        break;
+    case GEOMETRY_TYPE::AABB_LIST:
+        geometryBuildInput.type = hiprtPrimitiveTypeAABBList;
+        geometryBuildInput.primitive.aabbList.aabbCount = aabb.size();
+        geometryBuildInput.primitive.aabbList.aabbStride = sizeof(hiprt::Aabb);
+        geometryBuildInput.primitive.aabbList.aabbs = device_aabb;
+        break;
+    case GEOMETRY_TYPE::SPHERE_LIST:
+        geometryBuildInput.type = hiprtPrimitiveTypeAABBList;
+        geometryBuildInput.primitive.aabbList.aabbCount = aabb.size();
+        geometryBuildInput.primitive.aabbList.aabbStride = sizeof(hiprt::Aabb);
+        geometryBuildInput.primitive.aabbList.aabbs = device_aabb;
+        break;
+    default:
+        std::cerr << "Error to create GeometryType\n";
+    }
+    return geometryBuildInput; 
+}
+
+void BuildMeshes(std::vector<TriangleMesh>& meshes)
+{
+    for(auto& mesh : meshes)
+    {
+        mesh.Build();
+    }
+}
+
+void CollectGeometryBuildInputs(std::vector<hiprtGeometryBuildInput>& inputs, std::vector<TriangleMesh>& meshes)
+{
+    inputs.clear();
+    inputs.reserve(meshes.size());
+    for(auto& mesh: meshes)
+    {
+        if (!mesh.spheres.empty())
+        {
+            inputs.push_back(mesh.CreateBuildInput(GEOMETRY_TYPE::SPHERE_LIST));
+        }
+        else if (mesh.deformation_count > 1)
+        {
+            inputs.push_back(mesh.CreateBuildInput(GEOMETRY_TYPE::AABB_LIST));
+        }
+        else 
+            inputs.push_back(mesh.CreateBuildInput(GEOMETRY_TYPE::TRIANGLE_MESH));
+    }
+}
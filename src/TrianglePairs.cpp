@@ -0,0 +1,144 @@
+#include "TrianglePairs.h"
+#include "RadixSort.h"
+
+#include <algorithm>
+#include <bit>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+uint32_t EdgeVertex(const uint3& t, uint32_t corner)
+{
+    return corner == 0 ? t.x : (corner == 1 ? t.y : t.z);
+}
+
+} // namespace
+
+bool PairTriangles(const uint3* indices, uint32_t triangleCount, const std::vector<hiprt::Aabb>& triangleBoxes, std::vector<TrianglePair>& pairs, BvhBuildScratch* scratch)
+{
+    pairs.clear();
+    if (triangleCount == 0 || triangleBoxes.size() != triangleCount)
+    {
+        std::cerr << "Triangle pairs: no triangles or a box count that does not match\n";
+        return false;
+    }
+
+    // half edges sorted by their undirected edge (smaller vertex high), value 3 * triangle + first corner of the edge
+    uint32_t maxVertex = 0;
+    for (uint32_t i = 0; i < triangleCount; i++) maxVertex = std::max(maxVertex, std::max(indices[i].x, std::max(indices[i].y, indices[i].z)));
+    const uint32_t vertexBits = std::max(1u, static_cast<uint32_t>(std::bit_width(maxVertex)));
+
+    BvhBuildScratch localScratch;
+    BvhBuildScratch& buffers = scratch != nullptr ? *scratch : localScratch;
+    std::vector<uint64_t>& keys = buffers.edgeKeys;
+    std::vector<uint32_t>& halfEdges = buffers.halfEdges;
+    keys.resize(3 * triangleCount);
+    halfEdges.resize(3 * triangleCount);
+    for (uint32_t i = 0; i < triangleCount; i++)
+    {
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            const uint32_t a = EdgeVertex(indices[i], c);
+            const uint32_t b = EdgeVertex(indices[i], (c + 1) % 3);
+            keys[3 * i + c] = (static_cast<uint64_t>(std::min(a, b)) << vertexBits) | std::max(a, b);
+            halfEdges[3 * i + c] = 3 * i + c;
+        }
+    }
+    RadixSortPairs(keys, halfEdges, 2 * vertexBits, buffers.radixKeys64, buffers.radixValues);
+
+    // neighbours across the manifold edges, InvalidNodeIndex across borders and non-manifold edges
+    std::vector<uint32_t>& neighbours = buffers.neighbours;
+    neighbours.assign(3 * triangleCount, InvalidNodeIndex);
+    for (uint32_t begin = 0, end = 0; begin < keys.size(); begin = end)
+    {
+        end = begin + 1;
+        while (end < keys.size() && keys[end] == keys[begin]) end++;
+        if (end - begin != 2)
+            continue;
+        const uint32_t e0 = halfEdges[begin];
+        const uint32_t e1 = halfEdges[begin + 1];
+        const uint32_t t0 = e0 / 3;
+        const uint32_t t1 = e1 / 3;
+        // same winding means one of them is flipped, a pair would not be a quad
+        if (t0 == t1 || EdgeVertex(indices[t0], e0 % 3) == EdgeVertex(indices[t1], e1 % 3))
+            continue;
+        neighbours[e0] = t1;
+        neighbours[e1] = t0;
+    }
+
+    std::vector<uint8_t>& paired = buffers.paired;
+    paired.assign(triangleCount, 0);
+    pairs.reserve(triangleCount / 2 + 1);
+    for (uint32_t i = 0; i < triangleCount; i++)
+    {
+        if (paired[i])
+            continue;
+        paired[i] = 1;
+
+        uint32_t best = InvalidNodeIndex;
+        float bestArea = std::numeric_limits<float>::max();
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            const uint32_t n = neighbours[3 * i + c];
+            if (n == InvalidNodeIndex || paired[n])
+                continue;
+            hiprt::Aabb box = triangleBoxes[i];
+            box.grow(triangleBoxes[n]);
+            const float area = box.area();
+            if (area < triangleBoxes[i].area() + triangleBoxes[n].area() && area < bestArea)
+            {
+                best = n;
+                bestArea = area;
+            }
+        }
+        if (best != InvalidNodeIndex)
+            paired[best] = 1;
+        pairs.push_back({{i, best}});
+    }
+    return true;
+}
+
+bool BuildQuadBvh(const uint3* indices, uint32_t triangleCount, const std::vector<hiprt::Aabb>& triangleBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch)
+{
+    BvhBuildScratch localScratch;
+    BvhBuildScratch& buffers = scratch != nullptr ? *scratch : localScratch;
+    std::vector<TrianglePair>& pairs = buffers.pairs;
+    if (PairTriangles(indices, triangleCount, triangleBoxes, pairs, &buffers) == false)
+        return false;
+
+    std::vector<hiprt::Aabb>& pairBoxes = buffers.pairBoxes;
+    pairBoxes.resize(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        pairBoxes[i] = triangleBoxes[pairs[i].tri[0]];
+        if (pairs[i].tri[1] != InvalidNodeIndex)
+            pairBoxes[i].grow(triangleBoxes[pairs[i].tri[1]]);
+    }
+    // maxLeafSize still counts triangles, a full leaf fills the Triangle8 lanes it did before with half the primitives
+    BvhBuildOptions pairOptions = options;
+    pairOptions.maxLeafSize = std::max(1u, options.maxLeafSize / 2);
+    if (BuildBvh(pairBoxes, pairOptions, bvh, &buffers) == false)
+        return false;
+
+    // pair references to triangle references, leaf by leaf in the order of the nodes
+    std::vector<uint32_t> primIndices;
+    primIndices.reserve(triangleCount);
+    for (BvhNode& node : bvh.nodes)
+    {
+        if (!node.IsLeaf())
+            continue;
+        const uint32_t offset = static_cast<uint32_t>(primIndices.size());
+        for (uint32_t i = 0; i < node.primCount; i++)
+        {
+            const TrianglePair& pair = pairs[bvh.primIndices[node.primOffset + i]];
+            primIndices.push_back(pair.tri[0]);
+            if (pair.tri[1] != InvalidNodeIndex)
+                primIndices.push_back(pair.tri[1]);
+        }
+        node.primOffset = offset;
+        node.primCount = static_cast<uint32_t>(primIndices.size()) - offset;
+    }
+    bvh.primIndices = std::move(primIndices);
+    return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../kernels/shared.h"
+#include "Bvh.h"
+
+#include <vector>
+
+// Greedy pairing in triangle order across the manifold edges of the mesh (exactly two triangles with opposite winding).
+// A triangle takes the free neighbour with the smallest box over both, and only when that box is cheaper in SAH than the
+// two triangle boxes on their own, area(a + b) < area(a) + area(b). Every triangle ends up in exactly one pair.
+bool PairTriangles(const uint3* indices, uint32_t triangleCount, const std::vector<hiprt::Aabb>& triangleBoxes, std::vector<TrianglePair>& pairs, BvhBuildScratch* scratch = nullptr);
+
+// BuildBvh over the pairs of PairTriangles, a leaf holds up to options.maxLeafSize / 2 pairs. The triangles of every pair are
+// listed next to each other in primIndices, so the result is a triangle Bvh to everything after the build (refit, the wide
+// layouts, the Triangle8 leaves that test both triangles of a pair in one pass) with half the primitives to build over.
+bool BuildQuadBvh(const uint3* indices, uint32_t triangleCount, const std::vector<hiprt::Aabb>& triangleBoxes, const BvhBuildOptions& options, Bvh& bvh, BvhBuildScratch* scratch = nullptr);
@@ -7,6 +7,8 @@
 #include "ImageWriter.h"
 #include "MeshReader.h"
 #include "Scene.h"
+#include "CpuRenderer.h"
+#include "ProgressiveAccumulation.h"
 #include "TriangleMesh.h"
 #include "assert.h"
 
@@ -35,6 +37,7 @@ struct GeometryData
     uint32_t nDeformations{0};
     uint32_t geometryID{0};
     uint32_t instanceID{0};
+    float4* spheres{nullptr};
 };
 
 
@@ -118,6 +121,9 @@ int main(int argc, char const* argv[])
 
     hiprtDevicePtr outputImage;
     HIP_ASSERT(hipMalloc(&outputImage, width * height * 4) == hipSuccess, "malloc");
+    // running AO sum per pixel, the image is its mean
+    hiprtDevicePtr accumulation;
+    HIP_ASSERT(hipMalloc(&accumulation, width * height * sizeof(float)) == hipSuccess, "malloc");
 
     int2 resolution{width, height};
 
@@ -129,9 +135,13 @@ int main(int argc, char const* argv[])
     hipModule_t module{nullptr};
     HIP_ASSERT(hipModuleLoad(&module, "trace.hipfb") == hipSuccess, "module load");
     hipFunction_t kernel{nullptr};
-    HIP_ASSERT(hipModuleGetFunction(&kernel, module, "SimpleMeshIntersectionKernelCamera") == hipSuccess, "kernel load");
+    HIP_ASSERT(hipModuleGetFunction(&kernel, module, "AoRayKernelProgressive") == hipSuccess, "kernel load");
 
-    void* kernel_args[] = {&geometry, &outputImage, &resolution, &camera};
+    // every frame adds one sample to the accumulation while the view stands still, bump sceneVersion after changing the geometry
+    ProgressiveAccumulation progressive;
+    uint32_t sceneVersion = 0;
+    uint32_t sampleIndex = 0;
+    void* kernel_args[] = {&geometry, &accumulation, &outputImage, &resolution, &globalStackBuffer, &camera, &aoRadius, &sampleIndex};
 
     MainDisplayWindow MainWindow;      
 
@@ -140,6 +150,7 @@ int main(int argc, char const* argv[])
         MainWindow.PollEvents();
         MainWindow.Update();
 
+        sampleIndex = progressive.Advance(camera, aoRadius, sceneVersion);
         launchKernel(kernel, width, height, kernel_args, stream, blockWidth, blockHeight);
         //HIP_ASSERT(hipStreamSynchronize(stream) == hipSuccess, "stream sync");
 
@@ -156,6 +167,7 @@ int main(int argc, char const* argv[])
     HIP_ASSERT(hipModuleUnload(module) == hipSuccess, "module unload");
 
     HIP_ASSERT(hipFree(outputImage) == hipSuccess, "free");
+    HIP_ASSERT(hipFree(accumulation) == hipSuccess, "free");
     HIP_ASSERT(hiprtDestroyGlobalStackBuffer(rtContext, globalStackBuffer) == hiprtSuccess, "stack buffer");
     HIP_ASSERT(hiprtDestroyGeometry(rtContext, geometry) == hiprtSuccess, "Destroy geometries");
 
@@ -170,6 +182,7 @@ int main(int argc, char const* argv[])
     Render<CASE_TYPE::SCENE_TRANSFORMATION_MB_SLERP>(rtContext, stream, "../../scenes/sphere/s.obj", "../../scens/sphere/", "trannsform_slerp.png");
     Render<CASE_TYPE::SCENE_TRANSFORMATION_MB_AO_SLERP_2_INSTANCES>(rtContext, stream, "../../scenes/sphere/s.obj", "../../scens/sphere/", "slerp_2_instances.png");
     Render<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>(rtContext, stream, "../../scenes/cornellbox/cornellbox.obj", "../../scens/cornellbox/", "cb.png");
+    RenderCpu<CASE_TYPE::SCENE_AMBIENT_OCCLUSION>("../../scenes/cornellbox/cornellbox.obj", "../../scens/cornellbox/", "cb_cpu.png");
     */
 
     //Render<CASE_TYPE::SCENE_TRANSFORMATION_MB_DEFORMATION>(rtContext, stream, "../../scenes/sphere/s.obj", "../../scens/sphere/", "scene_transform_MB_deformation.png");